@@ -18,6 +18,8 @@ FATFS Fatfs;            /* File system object */
 FIL Fil;                /* File object */
 BYTE Buff[512*40];      /* File read buffer (40 SD card blocks to let multiblock operations (if file not fragmented) */
 
+#define LOOPS 100       /* Repetitions of each benchmark */
+
 void die(FRESULT rc ) /* Stop with dying message */
 {
   printf("\nFailed with rc=%u.\n", rc);
@@ -29,7 +31,7 @@ int main(void)
   FRESULT rc;                     /* Result code */
   DIR dir;                        /* Directory object */
   FILINFO fno;                    /* File information object */
-  UINT bw, br, i;
+  UINT bw, br, i, j;
   unsigned int T;
 
   for( i = 0; i < sizeof(Buff); i++) Buff[i] = i + i / 512; // fill the buffer with some data
@@ -100,6 +102,33 @@ int main(void)
 
   /****************************/
 
+  printf("\nCopy benchmark (timer ticks of 10ns)...\n");
+  rc = f_open(&Fil, "Data.bin", FA_READ);
+  if(rc) die(rc);
+  rc = f_read(&Fil, Buff, 1, &br); /* bring the first sector into the sector buffer */
+  if(rc) die(rc);
+  for(i = 0; i < 2; i++)
+  {
+    T = get_time();
+    for(j = 0; j < LOOPS; j++)
+    {
+      f_lseek(&Fil, 1);
+      f_read(&Fil, Buff + 1 + i, 511, &br); /* partial sector, copied from the sector buffer */
+    }
+    T = get_time() - T;
+    printf("511 bytes from sector offset 1 to buffer offset %d: %d ticks per read\n", 1 + i, T / LOOPS);
+  }
+  rc = f_close(&Fil);
+  if(rc) die(rc);
+
+  T = get_time();
+  for(j = 0; j < LOOPS; j++)
+    f_stat("NOFILE.BIN", &fno);    /* compares the name with every entry of the root directory */
+  T = get_time() - T;
+  printf("Root directory scan: %d ticks per scan\n", T / LOOPS);
+
+  /****************************/
+
   printf("\nOpen root directory.\n");
   rc = f_opendir(&dir, "");
   if(rc) die(rc);
@@ -113,7 +142,7 @@ int main(void)
       printf("   <dir>  %s\n", fno.fname);
     else
     {
-      printf("%8d  %s\n", fno.fsize, fno.fname);
+      printf("%8llu  %s\n", (unsigned long long)fno.fsize, fno.fname);
     }
   }
   if(rc) die(rc);
@@ -0,0 +1,650 @@
+/*-----------------------------------------------------------------------*/
+/* Compressed log file on top of FatFs                                   */
+/*-----------------------------------------------------------------------*/
+/* The pool is a ring of nbuf buffers, each with room for a frame header */
+/* in front of bsize data bytes. The producer queues buffer tail % nbuf, */
+/* the compressor compresses buffer comp % nbuf into its work area and   */
+/* copies the block back over the data, and the writer appends buffer    */
+/* head % nbuf to the file. The buffers between head and comp are the    */
+/* queue of the writer, so the card's busy time of one block overlaps    */
+/* the compression of the next. A block that does not get smaller stays  */
+/* as it is. Each stage has a doorbell channel, the protocol is the one  */
+/* of the disk server and the recorder.                                  */
+/*                                                                       */
+/* Blocks use the LZ4 block format. The compressor keeps the positions   */
+/* of 4 byte sequences in a hash table of 16 bit entries, reads the      */
+/* sequences byte by byte (the xCORE has no unaligned loads) and takes   */
+/* longer steps over data that does not compress.                        */
+/*-----------------------------------------------------------------------*/
+
+#include <string.h>
+#include "complog.h"
+#include "diskio.h"
+#include "hwlock.h"
+
+#if _USE_COMPLOG
+
+#if _FS_READONLY
+#error The compressed log needs a writable file system.
+#endif
+
+#define CL_MINMATCH  4    /* Shortest match */
+#define CL_LASTLIT  5    /* The last bytes of a block are literals */
+#define CL_MFLIMIT  12    /* No match starts in the last bytes of a block */
+
+#define CL_HASH(seq)  ((((seq) * 2654435761U) >> 22) & (CL_HTAB - 1))
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Compress a block                                                      */
+/*-----------------------------------------------------------------------*/
+
+static
+UINT lz_compress (  /* Block size, 0 when it does not fit in max bytes */
+  const BYTE *src,  /* Data */
+  UINT n,        /* Number of data bytes */
+  BYTE *dst,      /* Block */
+  UINT max,      /* Room for the block */
+  WORD *htab      /* Hash table (CL_HTAB entries) */
+)
+{
+  const BYTE *ip = src, *anchor = src, *ref, *mflimit, *mlimit;
+  BYTE *op = dst, *oend = dst + max, *tok;
+  DWORD seq;
+  UINT h, lit, ml, l;
+
+
+  memset(htab, 0, CL_HTAB * sizeof(WORD));
+  if (n > CL_MFLIMIT) {
+    mflimit = src + n - CL_MFLIMIT;
+    mlimit = src + n - CL_LASTLIT;
+    ip++;
+    while (ip < mflimit) {
+      seq = LD_DWORD(ip);
+      h = CL_HASH(seq);
+      ref = src + htab[h];
+      htab[h] = (WORD)(ip - src);
+      if (ref >= ip || LD_DWORD(ref) != seq) {
+        ip += 1 + ((UINT)(ip - anchor) >> 6);  /* Longer steps over literals */
+        continue;
+      }
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {  /* Extend the match backward */
+        ip--; ref--;
+      }
+      ml = CL_MINMATCH;              /* and forward */
+      while (ip + ml < mlimit && ip[ml] == ref[ml]) ml++;
+
+      lit = ip - anchor;
+      if ((UINT)(oend - op) < 1 + lit / 255 + 1 + lit + 2 + (ml - CL_MINMATCH) / 255 + 1)
+        return 0;
+      tok = op++;                  /* Token, literals, offset and match length */
+      if (lit >= 15) {
+        *tok = 15 << 4;
+        for (l = lit - 15; l >= 255; l -= 255) *op++ = 255;
+        *op++ = (BYTE)l;
+      } else {
+        *tok = (BYTE)(lit << 4);
+      }
+      memcpy(op, anchor, lit); op += lit;
+      l = ip - ref;
+      *op++ = (BYTE)l; *op++ = (BYTE)(l >> 8);
+      l = ml - CL_MINMATCH;
+      if (l >= 15) {
+        *tok |= 15;
+        for (l -= 15; l >= 255; l -= 255) *op++ = 255;
+        *op++ = (BYTE)l;
+      } else {
+        *tok |= (BYTE)l;
+      }
+      ip += ml;
+      anchor = ip;
+    }
+  }
+
+  lit = src + n - anchor;              /* The last literals */
+  if ((UINT)(oend - op) < 1 + lit / 255 + 1 + lit) return 0;
+  if (lit >= 15) {
+    *op++ = 15 << 4;
+    for (l = lit - 15; l >= 255; l -= 255) *op++ = 255;
+    *op++ = (BYTE)l;
+  } else {
+    *op++ = (BYTE)(lit << 4);
+  }
+  memcpy(op, anchor, lit); op += lit;
+
+  return op - dst;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decompress a block                                                    */
+/*-----------------------------------------------------------------------*/
+
+static
+int lz_decompress (  /* Number of data bytes, -1 when the block is broken */
+  const BYTE *src,  /* Block */
+  UINT n,        /* Number of block bytes */
+  BYTE *dst,      /* Data */
+  UINT max      /* Room for the data */
+)
+{
+  const BYTE *ip = src, *iend = src + n, *ref;
+  BYTE *op = dst, *oend = dst + max;
+  UINT lit, ml, b;
+
+
+  while (ip < iend) {
+    b = *ip++;
+    lit = b >> 4;
+    ml = b & 15;
+    if (lit == 15) {
+      do {
+        if (ip >= iend) return -1;
+        b = *ip++;
+        lit += b;
+      } while (b == 255);
+    }
+    if (lit > (UINT)(iend - ip) || lit > (UINT)(oend - op)) return -1;
+    memcpy(op, ip, lit); op += lit; ip += lit;
+    if (ip >= iend) break;              /* The last literals */
+
+    if (iend - ip < 2) return -1;
+    b = ip[0] | ip[1] << 8;
+    ip += 2;
+    if (!b || b > (UINT)(op - dst)) return -1;
+    ref = op - b;
+    if (ml == 15) {
+      do {
+        if (ip >= iend) return -1;
+        b = *ip++;
+        ml += b;
+      } while (b == 255);
+    }
+    ml += CL_MINMATCH;
+    if (ml > (UINT)(oend - op)) return -1;
+    while (ml--) *op++ = *ref++;        /* The match may overlap the output */
+  }
+
+  return op - dst;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Open the log and set up the pool                                      */
+/*-----------------------------------------------------------------------*/
+/* New blocks are appended to an existing log. A file that does not     */
+/* start with a frame header is not a log, FR_INVALID_OBJECT.            */
+
+FRESULT clog_open (
+  CLOG *l,      /* Compressed log object */
+  const TCHAR *path,  /* Log file */
+  BYTE *pool,      /* Buffer pool of CL_POOL(nbuf, bsize) bytes, word aligned */
+  UINT nbuf,      /* Number of buffers (2..) */
+  UINT bsize,      /* Buffer size in bytes (multiple of 4, up to 32KB) */
+  BYTE *work      /* Work area of CL_WORK(bsize) bytes, word aligned */
+)
+{
+  FRESULT res;
+  UINT br;
+
+
+  if (nbuf < 2 || !bsize || bsize % 4 || bsize > 32768) return FR_INVALID_PARAMETER;
+
+  res = f_open(&l->file, path, FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
+  if (res != FR_OK) return res;
+  if (l->file.fsize) {          /* Check the first frame header of an existing file */
+    res = f_read(&l->file, work, CL_HDR, &br);
+    if (res == FR_OK && (br != CL_HDR
+      || LD_WORD(work+CL_MAGIC) != CL_SIG || LD_WORD(work+CL_RSV) != 0))
+      res = FR_INVALID_OBJECT;
+  }
+  if (res == FR_OK)
+    res = f_lseek(&l->file, l->file.fsize);
+  if (res == FR_OK) {
+    l->lock = hwlock_alloc();
+    if (l->lock == HWLOCK_NONE) res = FR_NOT_ENOUGH_CORE;
+  }
+  if (res != FR_OK) {
+    f_close(&l->file);
+    return res;
+  }
+
+  l->pool = pool;
+  l->work = work;
+  l->nbuf = nbuf;
+  l->bsize = bsize;
+  l->head = l->comp = l->tail = 0;
+  l->nsync = 0;
+  l->res = FR_OK;
+  l->sleeping = 1;    /* Both stages start waiting for the first doorbell */
+  l->wsleeping = 1;
+  l->stop = l->cdone = 0;
+  memset(&l->stat, 0, sizeof l->stat);
+
+  return FR_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Register the producer end of the channel to the compressor            */
+/*-----------------------------------------------------------------------*/
+
+void clog_attach (
+  CLOG *l,    /* Compressed log object */
+  chanend c    /* Producer end of the channel */
+)
+{
+  l->c = c;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the next free buffer                                              */
+/*-----------------------------------------------------------------------*/
+/* Returns 0 without waiting when all buffers are queued (an overrun).   */
+/* The buffer is queued by clog_put().                                   */
+
+BYTE* clog_get (
+  CLOG *l      /* Compressed log object */
+)
+{
+  DWORD used;
+
+
+  hwlock_acquire(l->lock);
+  used = l->tail - l->head;
+  hwlock_release(l->lock);
+  if (l->stop || used >= l->nbuf) {
+    l->stat.overruns++;
+    return 0;
+  }
+  return l->pool + (l->tail % l->nbuf) * (CL_HDR + l->bsize) + CL_HDR;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Queue the buffer got last                                             */
+/*-----------------------------------------------------------------------*/
+/* Any buffer may hold less than bsize bytes, it becomes a shorter       */
+/* block.                                                                */
+
+void clog_put (
+  CLOG *l,    /* Compressed log object */
+  UINT len    /* Number of data bytes in the buffer */
+)
+{
+  BYTE *hdr = l->pool + (l->tail % l->nbuf) * (CL_HDR + l->bsize);
+  DWORD used;
+  BYTE s;
+
+
+  if (len > l->bsize) len = l->bsize;
+  if (!len) return;
+  ST_WORD(hdr+CL_MAGIC, CL_SIG);
+  ST_WORD(hdr+CL_RLEN, len);
+  ST_WORD(hdr+CL_CLEN, len);
+  ST_WORD(hdr+CL_RSV, 0);
+  hwlock_acquire(l->lock);
+  l->tail++;
+  used = l->tail - l->head;
+  s = l->sleeping;
+  l->sleeping = 0;
+  hwlock_release(l->lock);
+  l->stat.queued++;
+  l->stat.raw += len;
+  if (used > l->stat.max_used) l->stat.max_used = used;
+  if (s) disk_chan_signal(l->c);  /* Ring the doorbell */
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Finish the log                                                        */
+/*-----------------------------------------------------------------------*/
+/* Waits until the queued buffers are written and the file is closed.    */
+
+FRESULT clog_close (
+  CLOG *l      /* Compressed log object */
+)
+{
+  BYTE s;
+
+
+  hwlock_acquire(l->lock);
+  l->stop = 1;
+  s = l->sleeping;
+  l->sleeping = 0;
+  hwlock_release(l->lock);
+  if (s) disk_chan_signal(l->c);  /* Wake up the compressor */
+  disk_chan_wait(l->c);      /* Wait for the file to be closed */
+  hwlock_free(l->lock);
+
+  return l->res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Sync the file                                                         */
+/*-----------------------------------------------------------------------*/
+/* Puts the size and the FAT chain of the blocks written so far on the   */
+/* card.                                                                 */
+
+static
+void clog_sync (
+  CLOG *l      /* Compressed log object */
+)
+{
+  if (l->res == FR_OK) {
+    l->res = f_sync(&l->file);
+    l->stat.syncs++;
+  }
+  l->nsync = 0;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Compress the queued buffers                                           */
+/*-----------------------------------------------------------------------*/
+/* The block is built in the work area and copied over the data of the   */
+/* buffer, then the buffer moves on to the queue of the writer.          */
+
+static
+int clog_squeeze (  /* 1:Log closed, 0:Queue empty */
+  CLOG *l,    /* Compressed log object */
+  chanend cw    /* Compressor end of the channel to the writer */
+)
+{
+  BYTE *hdr, s;
+  UINT rlen, clen;
+
+
+  for (;;) {
+    hwlock_acquire(l->lock);
+    if (l->tail == l->comp) {
+      if (l->stop) {
+        hwlock_release(l->lock);
+        return 1;
+      }
+      l->sleeping = 1;
+      hwlock_release(l->lock);
+      return 0;
+    }
+    hwlock_release(l->lock);
+
+    if (l->res == FR_OK) {        /* After an error the buffers are dropped */
+      hdr = l->pool + (l->comp % l->nbuf) * (CL_HDR + l->bsize);
+      rlen = LD_WORD(hdr+CL_RLEN);
+      clen = lz_compress(hdr + CL_HDR, rlen, l->work, rlen - 1, l->htab);
+      if (clen) {              /* Compressed block */
+        memcpy(hdr + CL_HDR, l->work, clen);
+        ST_WORD(hdr+CL_CLEN, clen);
+      } else {              /* Stored block */
+        l->stat.stored++;
+      }
+    }
+
+    hwlock_acquire(l->lock);
+    l->comp++;
+    s = l->wsleeping;
+    l->wsleeping = 0;
+    hwlock_release(l->lock);
+    if (s) disk_chan_signal(cw);  /* Ring the doorbell of the writer */
+  }
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Compressor task                                                       */
+/*-----------------------------------------------------------------------*/
+/* Runs on its own core until clog_close(). It hands the end of the log  */
+/* on to the writer and tells clog_close() when the file is closed.      */
+
+void clog_compressor (
+  CLOG *l,    /* Compressed log object */
+  chanend c,    /* Compressor end of the channel to the producer */
+  chanend cw    /* Compressor end of the channel to the writer */
+)
+{
+  BYTE s;
+
+
+  do
+    disk_chan_wait(c);    /* Sleep until the producer rings the doorbell */
+  while (!clog_squeeze(l, cw));
+
+  hwlock_acquire(l->lock);
+  l->cdone = 1;
+  s = l->wsleeping;
+  l->wsleeping = 0;
+  hwlock_release(l->lock);
+  if (s) disk_chan_signal(cw);  /* Wake up the writer */
+  disk_chan_wait(cw);      /* Wait for the file to be closed */
+  disk_chan_signal(c);    /* Tell clog_close() */
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write the compressed buffers                                          */
+/*-----------------------------------------------------------------------*/
+
+static
+int clog_drain (  /* 1:Log closed, 0:Queue empty */
+  CLOG *l      /* Compressed log object */
+)
+{
+  BYTE *hdr;
+  UINT clen, bw;
+
+
+  for (;;) {
+    hwlock_acquire(l->lock);
+    if (l->comp == l->head) {
+      if (l->cdone) {
+        hwlock_release(l->lock);
+        return 1;
+      }
+      if (l->nsync && l->tail == l->head) {  /* The producer has gone quiet, sync before sleeping */
+        hwlock_release(l->lock);
+        clog_sync(l);
+        continue;
+      }
+      l->wsleeping = 1;
+      hwlock_release(l->lock);
+      return 0;
+    }
+    hwlock_release(l->lock);
+
+    if (l->res == FR_OK) {
+      hdr = l->pool + (l->head % l->nbuf) * (CL_HDR + l->bsize);
+      clen = LD_WORD(hdr+CL_CLEN);
+      l->res = f_write(&l->file, hdr, CL_HDR + clen, &bw);
+      if (l->res == FR_OK && bw != CL_HDR + clen) l->res = FR_DENIED;  /* Volume full */
+      l->stat.written += bw;
+      if (l->res == FR_OK && ++l->nsync >= CL_SYNC) clog_sync(l);
+    }
+
+    hwlock_acquire(l->lock);
+    l->head++;
+    hwlock_release(l->lock);
+  }
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Writer task                                                           */
+/*-----------------------------------------------------------------------*/
+/* Runs on its own core until the compressor has handled the last buffer */
+/* then closes the file.                                                 */
+
+FRESULT clog_writer (
+  CLOG *l,    /* Compressed log object */
+  chanend c    /* Writer end of the channel to the compressor */
+)
+{
+  FRESULT res;
+
+
+  do
+    disk_chan_wait(c);    /* Sleep until the compressor rings the doorbell */
+  while (!clog_drain(l));
+
+  res = f_close(&l->file);
+  if (l->res == FR_OK) l->res = res;
+  disk_chan_signal(c);    /* Tell the compressor */
+
+  return l->res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Open a log for reading                                                */
+/*-----------------------------------------------------------------------*/
+
+FRESULT clog_ropen (
+  CLOGRD *r,      /* Reader object */
+  const TCHAR *path,  /* Log file */
+  UINT bsize,      /* Buffer size the log was written with */
+  BYTE *work      /* Work area of CL_WORK(bsize) bytes */
+)
+{
+  if (!bsize || bsize > 32768) return FR_INVALID_PARAMETER;
+
+  r->work = work;
+  r->bsize = bsize;
+  r->block = 0;
+
+  return f_open(&r->file, path, FA_READ);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read the frame header of the next block                               */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT clog_frame (
+  CLOGRD *r,    /* Reader object */
+  UINT *rlen,    /* Pointer to return the number of data bytes (0:End of the log) */
+  UINT *clen    /* Pointer to return the number of block bytes */
+)
+{
+  FRESULT res;
+  UINT br;
+
+
+  *rlen = *clen = 0;
+  res = f_read(&r->file, r->work, CL_HDR, &br);
+  if (res != FR_OK || !br) return res;
+  if (br < CL_HDR) return FR_OK;      /* A frame cut by a power failure ends the log */
+  *rlen = LD_WORD(r->work+CL_RLEN);
+  *clen = LD_WORD(r->work+CL_CLEN);
+  if (LD_WORD(r->work+CL_MAGIC) != CL_SIG || !*rlen || *rlen > r->bsize || !*clen || *clen > *rlen) {
+    *rlen = *clen = 0;
+    return FR_INVALID_OBJECT;
+  }
+  if (r->file.fsize - r->file.fptr < *clen)  /* Cut block */
+    *rlen = *clen = 0;
+
+  return FR_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read the next block                                                   */
+/*-----------------------------------------------------------------------*/
+/* The data of the block are returned in buff, which holds bsize bytes.  */
+/* *len is 0 at the end of the log.                                      */
+
+FRESULT clog_read (
+  CLOGRD *r,    /* Reader object */
+  BYTE *buff,    /* Buffer of bsize bytes to return the data */
+  UINT *len    /* Pointer to return the number of data bytes */
+)
+{
+  FRESULT res;
+  UINT rlen, clen, br;
+
+
+  *len = 0;
+  res = clog_frame(r, &rlen, &clen);
+  if (res != FR_OK || !rlen) return res;
+
+  if (clen == rlen) {            /* Stored block */
+    res = f_read(&r->file, buff, rlen, &br);
+  } else {                /* Compressed block */
+    res = f_read(&r->file, r->work, clen, &br);
+    if (res == FR_OK && lz_decompress(r->work, clen, buff, rlen) != (int)rlen)
+      res = FR_INVALID_OBJECT;
+  }
+  if (res != FR_OK) return res;
+  r->block++;
+  *len = rlen;
+
+  return FR_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Move to a block                                                       */
+/*-----------------------------------------------------------------------*/
+/* Walks the frame headers, from the current block when moving forward.  */
+/* A block number past the end moves to the end of the log.              */
+
+FRESULT clog_seek (
+  CLOGRD *r,    /* Reader object */
+  DWORD block    /* Block number (0:First block) */
+)
+{
+  FRESULT res = FR_OK;
+  UINT rlen, clen;
+  FSIZE_t ofs;
+
+
+  if (block < r->block) {
+    res = f_lseek(&r->file, 0);
+    r->block = 0;
+  }
+  while (res == FR_OK && r->block < block) {
+    ofs = r->file.fptr;
+    res = clog_frame(r, &rlen, &clen);
+    if (res != FR_OK) break;
+    if (!rlen) {              /* End of the log */
+      res = f_lseek(&r->file, ofs);
+      break;
+    }
+    res = f_lseek(&r->file, r->file.fptr + clen);
+    r->block++;
+  }
+
+  return res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Close a log opened for reading                                        */
+/*-----------------------------------------------------------------------*/
+
+FRESULT clog_rclose (
+  CLOGRD *r    /* Reader object */
+)
+{
+  return f_close(&r->file);
+}
+
+#endif /* _USE_COMPLOG */
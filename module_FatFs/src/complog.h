@@ -0,0 +1,95 @@
+/*-----------------------------------------------------------------------
+/  Compressed log file on top of FatFs
+/-----------------------------------------------------------------------*/
+/* A producer core fills the buffers of a pool and queues them without
+/  blocking, a compressor core turns each buffer into a block of the LZ4
+/  block format in place and a writer core appends the blocks to the file
+/  with f_write(), so a block is compressed while the one before it is
+/  written. Every block has a frame header, so a log can be read back and
+/  sought block by block.
+/  The writer syncs the file every CL_SYNC blocks and whenever the queue
+/  runs empty, so a power failure loses the queued buffers and at most the
+/  CL_SYNC - 1 blocks written since the last sync. */
+
+#ifndef _COMPLOG
+
+#include "ff.h"
+#include <xccompat.h>
+
+#if _USE_COMPLOG
+
+/* Layout of the frame header in front of each block */
+#define CL_MAGIC        0               /* Signature CL_SIG (WORD) */
+#define CL_RLEN         2               /* Number of data bytes (WORD) */
+#define CL_CLEN         4               /* Number of block bytes, CL_RLEN when stored uncompressed (WORD) */
+#define CL_RSV          6               /* Reserved (WORD, 0) */
+#define CL_HDR          8               /* Size of the frame header */
+#define CL_SIG          0x5A4C          /* "LZ" */
+
+#define CL_HTAB         1024            /* Entries of the hash table of the compressor */
+#define CL_SYNC         16              /* Blocks written between syncs of the file */
+
+/* Size of a pool of nbuf buffers of bsize bytes, and of the work area */
+#define CL_POOL(nbuf,bsize)     ((nbuf) * (CL_HDR + (bsize)))
+#define CL_WORK(bsize)          (CL_HDR + (bsize))
+
+/* Statistics of a log */
+typedef struct {
+        DWORD   queued;                 /* Buffers queued by the producer */
+        DWORD   overruns;               /* clog_get() calls that found no free buffer */
+        DWORD   stored;                 /* Blocks stored uncompressed */
+        DWORD   max_used;               /* Largest number of buffers in the queue */
+        DWORD   raw;                    /* Data bytes queued */
+        DWORD   written;                /* Bytes written to the file, frame headers included */
+        DWORD   syncs;                  /* f_sync() calls of the writer */
+} CLSTAT;
+
+#ifndef __XC__
+/* Compressed log object. The counters are guarded by the hardware lock. */
+typedef struct {
+        FIL     file;                   /* Log file */
+        BYTE*   pool;                   /* Buffer pool (CL_POOL(nbuf, bsize) bytes) */
+        BYTE*   work;                   /* Work area of the compressor (CL_WORK(bsize) bytes) */
+        UINT    bsize;                  /* Buffer size in bytes */
+        UINT    nbuf;                   /* Number of buffers */
+        DWORD   head;                   /* Buffers written by the writer */
+        DWORD   comp;                   /* Buffers compressed by the compressor */
+        DWORD   tail;                   /* Buffers queued by the producer */
+        UINT    nsync;                  /* Blocks written since the last sync */
+        FRESULT res;                    /* Result of the writes */
+        BYTE    sleeping;               /* The compressor waits for a doorbell */
+        BYTE    wsleeping;              /* The writer waits for a doorbell */
+        BYTE    stop;                   /* The producer has closed the log */
+        BYTE    cdone;                  /* The compressor has handled the last buffer */
+        unsigned lock;                  /* Hardware lock */
+        chanend c;                      /* Producer end of the channel to the compressor */
+        CLSTAT  stat;                   /* Statistics */
+        WORD    htab[CL_HTAB];          /* Hash table of the compressor */
+} CLOG;
+
+/* Compressed log reader object */
+typedef struct {
+        FIL     file;                   /* Log file */
+        BYTE*   work;                   /* Work area (CL_WORK(bsize) bytes) */
+        UINT    bsize;                  /* Largest block size in bytes */
+        DWORD   block;                  /* Number of the next block */
+} CLOGRD;
+
+FRESULT clog_open (CLOG*, const TCHAR*, BYTE*, UINT, UINT, BYTE*);     /* Create or append to a log and set up the pool (FR_INVALID_OBJECT: not a log) */
+void clog_attach (CLOG*, chanend);      /* Register the producer end of the channel */
+BYTE* clog_get (CLOG*);                 /* Get the next free buffer (non-blocking) */
+void clog_put (CLOG*, UINT);            /* Queue the buffer got last */
+FRESULT clog_close (CLOG*);             /* Finish the log and close the file */
+void clog_compressor (CLOG*, chanend, chanend); /* Compressor task */
+FRESULT clog_writer (CLOG*, chanend);   /* Writer task */
+
+FRESULT clog_ropen (CLOGRD*, const TCHAR*, UINT, BYTE*);       /* Open a log for reading */
+FRESULT clog_read (CLOGRD*, BYTE*, UINT*);      /* Read the next block */
+FRESULT clog_seek (CLOGRD*, DWORD);     /* Move to a block */
+FRESULT clog_rclose (CLOGRD*);          /* Close a log opened for reading */
+#endif
+
+#endif /* _USE_COMPLOG */
+
+#define _COMPLOG
+#endif
@@ -0,0 +1,138 @@
+/*-----------------------------------------------------------------------*/
+/* Idle time defragmenter on top of FatFs                                */
+/*-----------------------------------------------------------------------*/
+/* A call of dfg_idle() either reads the next directory entry and starts */
+/* defragmenting the file, or copies one buffer of the file being        */
+/* defragmented. Files open elsewhere (_FS_SHARE), changed while being   */
+/* copied, without room for a contiguous block or with a name that does  */
+/* not fit the path buffer are skipped.                                  */
+/*-----------------------------------------------------------------------*/
+
+#include "defrag.h"
+
+#if _USE_DEFRAG
+
+#if _FS_READONLY
+#error The defragmenter needs a writable file system.
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Start going through a directory                                       */
+/*-----------------------------------------------------------------------*/
+
+FRESULT dfg_open (
+  DFGSCHED *d,    /* Defragmenter object */
+  const TCHAR *path,  /* Directory path */
+  void *buff,      /* Copy buffer (a multiple of the sector size) */
+  UINT btr      /* Size of the copy buffer in bytes */
+)
+{
+  UINT n;
+
+
+  for (n = 0; path[n]; n++) {
+    if (n >= DFG_PATH - 14) return FR_INVALID_NAME;  /* No room for a '/' and a file name */
+    d->path[n] = path[n];
+  }
+  if (n && path[n - 1] != '/' && path[n - 1] != ':') d->path[n++] = '/';
+  d->plen = n;
+  d->buf = buff;
+  d->btr = btr;
+  d->busy = 0;
+  d->done = 0;
+  d->stat.files = d->stat.moved = d->stat.skipped = d->stat.clusters = 0;
+
+  return f_opendir(&d->dir, path);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Do a step of work                                                     */
+/*-----------------------------------------------------------------------*/
+/* To be called when the application has nothing else to do. Returns     */
+/* without doing anything once d->done is set.                           */
+
+FRESULT dfg_idle (
+  DFGSCHED *d    /* Defragmenter object */
+)
+{
+  FRESULT res;
+  FILINFO fno;
+  DWORD left;
+  UINT i;
+
+
+  if (d->busy) {              /* Copy a part of the file */
+    res = f_defrag_step(&d->df, &left);
+    if (res == FR_OK && left) return FR_OK;
+    d->busy = 0;
+    if (res == FR_OK) d->stat.moved++; else d->stat.skipped++;
+    f_close(&d->file);
+    return (res == FR_DENIED) ? FR_OK : res;  /* A file changed meanwhile is not an error */
+  }
+  if (d->done) return FR_OK;
+
+#if _USE_LFN
+  fno.lfname = d->path + d->plen;    /* The long name goes straight behind the directory path */
+  fno.lfsize = DFG_PATH - d->plen;
+#endif
+  res = f_readdir(&d->dir, &fno);      /* Next file */
+  if (res != FR_OK) return res;
+  if (!fno.fname[0]) {
+    d->done = 1;
+    return FR_OK;
+  }
+  if (fno.fattrib & (AM_DIR | AM_RDO | AM_SYS)) return FR_OK;
+  d->stat.files++;
+
+#if _USE_LFN
+  if (!d->path[d->plen])          /* No long name or too long for the path buffer */
+#endif
+  {
+    for (i = 0; fno.fname[i]; i++) d->path[d->plen + i] = fno.fname[i];
+    d->path[d->plen + i] = 0;
+  }
+  res = f_open(&d->file, d->path, FA_READ | FA_WRITE | FA_OPEN_EXISTING);
+  if (res == FR_LOCKED || res == FR_INVALID_NAME || res == FR_NO_FILE) {  /* Open elsewhere or the name did not fit ("?" on exFAT) */
+    d->stat.skipped++;
+    return FR_OK;
+  }
+  if (res != FR_OK) return res;
+  res = f_defrag(&d->df, &d->file, d->buf, d->btr);
+  if (res == FR_OK && d->df.ncl) {      /* Fragmented, the copy starts at the next call */
+    d->busy = 1;
+    d->stat.clusters += d->df.ncl;
+    return FR_OK;
+  }
+  f_close(&d->file);
+  if (res == FR_DENIED) {          /* No free block as large as the file */
+    d->stat.skipped++;
+    res = FR_OK;
+  }
+
+  return res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Finish the file being copied and stop                                 */
+/*-----------------------------------------------------------------------*/
+
+FRESULT dfg_close (
+  DFGSCHED *d    /* Defragmenter object */
+)
+{
+  FRESULT res = FR_OK;
+
+
+  while (d->busy && res == FR_OK) res = dfg_idle(d);
+  d->done = 1;
+
+  return res;
+}
+
+#endif /* _USE_DEFRAG */
@@ -0,0 +1,45 @@
+/*-----------------------------------------------------------------------
+/  Idle time defragmenter on top of FatFs
+/-----------------------------------------------------------------------*/
+/* Goes through the files of a directory and makes the fragmented ones
+/  contiguous with f_defrag(), a small step per call of dfg_idle(), so
+/  it can run in the idle loop of the application next to disk_idle(). */
+
+#ifndef _DEFRAG
+
+#include "ff.h"
+
+#if _USE_DEFRAG
+
+#define DFG_PATH        64              /* Size of the path buffer in TCHAR */
+
+/* Statistics of a defragmenter run */
+typedef struct {
+        DWORD   files;                  /* Files examined */
+        DWORD   moved;                  /* Files made contiguous */
+        DWORD   skipped;                /* Files in use, changed or without room for a block */
+        DWORD   clusters;               /* Clusters copied */
+} DFGSTAT;
+
+/* Idle time defragmenter object */
+typedef struct {
+        DIR     dir;                    /* Directory gone through */
+        FIL     file;                   /* File being defragmented */
+        DEFRAG  df;                     /* Defragmenter object of the file */
+        BYTE*   buf;                    /* Copy buffer */
+        UINT    btr;                    /* Size of the copy buffer in bytes */
+        UINT    plen;                   /* Length of the directory path */
+        BYTE    busy;                   /* A file is being copied */
+        BYTE    done;                   /* The whole directory has been gone through */
+        TCHAR   path[DFG_PATH];         /* Directory path, followed by the name of the file */
+        DFGSTAT stat;                   /* Statistics */
+} DFGSCHED;
+
+FRESULT dfg_open (DFGSCHED*, const TCHAR*, void*, UINT);       /* Start going through a directory */
+FRESULT dfg_idle (DFGSCHED*);           /* Do a step of work */
+FRESULT dfg_close (DFGSCHED*);          /* Finish the file being copied and stop */
+
+#endif /* _USE_DEFRAG */
+
+#define _DEFRAG
+#endif
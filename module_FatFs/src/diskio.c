@@ -0,0 +1,1568 @@
+/*-----------------------------------------------------------------------*/
+/* Disk I/O layer between FatFs and the SD host driver                   */
+/*-----------------------------------------------------------------------*/
+/* The SD host driver (SDCardHostSPI.xc or SDCardHost4Bit.xc) exports    */
+/* the SD_disk_xxx() functions. This module provides the disk_xxx()      */
+/* functions called by FatFs and adds the buffering stages configured    */
+/* in diskio.h on top of the driver.                                     */
+/*-----------------------------------------------------------------------*/
+
+#include <string.h>
+#include "diskio.h"
+#if _DISK_ASYNC
+#include "hwlock.h"
+#endif
+
+#if _DISK_ARRAY && (_DISK_ARRAY < 2 || _DISK_ARRAY > _DRIVES)
+#error _DISK_ARRAY must be 2.._DRIVES.
+#endif
+
+#if _DISK_ARRAY
+#define ARR(drv)    ((drv) == 0)  /* Drive 0 is the array of the drives 0.._DISK_ARRAY-1 */
+#define BAD_DRV(drv)  ((drv) >= _DRIVES || ((drv) && (drv) < _DISK_ARRAY))  /* Members are not accessed directly */
+#else
+#define ARR(drv)    0
+#define BAD_DRV(drv)  ((drv) >= _DRIVES)
+#endif
+
+#if _DISK_ASYNC
+#define SRV(drv)    (Srv[drv].attached && !ARR(drv))  /* The drive itself is driven by a server */
+#endif
+
+
+
+/*--------------------------------------------------------------------------
+
+   Module Private Functions
+
+---------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------*/
+/* Read/Write a segment list in one multiple block transfer session      */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT vec_read (
+  BYTE drv,      /* Physical drive number */
+  const DISKVEC *vec,  /* Segment list */
+  UINT nvec,      /* Number of segments */
+  DWORD sector    /* Start sector number (LBA) */
+)
+{
+  DRESULT res;
+  UINT i, n;
+
+
+  if (nvec == 1 && vec[0].count <= 255)  /* A single segment is a plain read */
+    return SD_disk_read(drv, vec[0].buff, sector, (BYTE)vec[0].count);
+
+  res = SD_disk_read_start(drv, sector);
+  if (res != RES_OK) return res;
+  for (i = 0; i < nvec && res == RES_OK; i++) {
+    for (n = 0; n < vec[i].count && res == RES_OK; n++)
+      res = SD_disk_read_next(drv, vec[i].buff + n * 512);
+  }
+  if (SD_disk_read_stop(drv) != RES_OK) res = RES_ERROR;
+  return res;
+}
+
+#if !_READONLY
+static
+DRESULT vec_write (
+  BYTE drv,      /* Physical drive number */
+  const DISKVEC *vec,  /* Segment list */
+  UINT nvec,      /* Number of segments */
+  DWORD sector    /* Start sector number (LBA) */
+)
+{
+  DRESULT res;
+  DWORD cnt;
+  UINT i, n;
+
+
+  if (nvec == 1 && vec[0].count <= 255)  /* A single segment is a plain write */
+    return SD_disk_write(drv, vec[0].buff, sector, (BYTE)vec[0].count);
+
+  for (cnt = i = 0; i < nvec; i++) cnt += vec[i].count;
+  res = SD_disk_write_start(drv, sector, cnt);
+  if (res != RES_OK) return res;
+  for (i = 0; i < nvec && res == RES_OK; i++) {
+    for (n = 0; n < vec[i].count && res == RES_OK; n++)
+      res = SD_disk_write_next(drv, vec[i].buff + n * 512);
+  }
+  if (SD_disk_write_stop(drv) != RES_OK) res = RES_ERROR;
+  return res;
+}
+#endif
+
+
+#if _DISK_ASYNC
+/* Disk server context. The queue, the sleeping flag and the request states */
+/* are shared by the server and the client core and guarded by the lock.    */
+static struct {
+  DISKREQ* q[_DISK_QUEUE];  /* Queued requests */
+  BYTE  head;          /* Number of requests taken off the queue (mod 256) */
+  BYTE  tail;          /* Number of requests put into the queue (mod 256) */
+  BYTE  sleeping;        /* The server waits for a doorbell */
+  BYTE  attached;        /* A client is attached */
+  unsigned lock;        /* Hardware lock */
+  chanend c;          /* Client end of the server channel */
+} Srv[_DRIVES];
+
+
+/*-----------------------------------------------------------------------*/
+/* Execute a request on the server core                                  */
+/*-----------------------------------------------------------------------*/
+
+static
+void srv_exec (
+  DISKREQ* req    /* Request to be executed */
+)
+{
+  switch (req->op) {
+  case DISK_OP_READ :
+    req->res = SD_disk_read(req->drv, req->buff, req->sector, req->count);
+    break;
+#if !_READONLY
+  case DISK_OP_WRITE :
+    req->res = SD_disk_write(req->drv, req->buff, req->sector, req->count);
+    break;
+#endif
+  case DISK_OP_READV :
+    req->res = vec_read(req->drv, (const DISKVEC*)req->buff, req->count, req->sector);
+    break;
+#if !_READONLY
+  case DISK_OP_WRITEV :
+    req->res = vec_write(req->drv, (const DISKVEC*)req->buff, req->count, req->sector);
+    break;
+#endif
+  case DISK_OP_READC :
+    req->res = SD_disk_read_chan(req->drv, req->chan, req->sector, req->count);
+    break;
+  case DISK_OP_IOCTL :
+    req->res = SD_disk_ioctl(req->drv, req->count, req->buff);
+    break;
+  case DISK_OP_INIT :
+    req->stat = SD_disk_initialize(req->drv);
+    req->res = RES_OK;
+    break;
+  case DISK_OP_STATUS :
+    req->stat = SD_disk_status(req->drv);
+    req->res = RES_OK;
+    break;
+  default :
+    req->res = RES_PARERR;
+  }
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Pass a request to the server and wait for it                          */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT srv_call (
+  DISKREQ* req,    /* Request descriptor to be used */
+  BYTE op,      /* Operation */
+  BYTE drv,      /* Physical drive number */
+  BYTE *buff,      /* Data buffer */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count or control code */
+)
+{
+  req->op = op; req->drv = drv; req->buff = buff;
+  req->sector = sector; req->count = count;
+  disk_submit(req);
+  return disk_wait(req);
+}
+#endif
+
+
+/*-----------------------------------------------------------------------*/
+/* Stream sectors of a drive on the driver or on the server              */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT drv_read_chan (
+  BYTE drv,      /* Physical drive number */
+  DISKCHAN c,      /* Streaming channel end to the consumer */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count (1..255) */
+)
+{
+#if _DISK_ASYNC
+  DISKREQ req;
+
+
+  if (Srv[drv].attached) {
+    req.chan = c;
+    return srv_call(&req, DISK_OP_READC, drv, 0, sector, count);
+  }
+#endif
+  return SD_disk_read_chan(drv, c, sector, count);
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Control a drive on the driver or on the server                        */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT drv_ioctl (
+  BYTE drv,      /* Physical drive number */
+  BYTE ctrl,      /* Control code */
+  BYTE *buff      /* Buffer to send/receive control data */
+)
+{
+#if _DISK_ASYNC
+  DISKREQ req;
+
+
+  if (Srv[drv].attached)
+    return srv_call(&req, DISK_OP_IOCTL, drv, buff, 0, ctrl);
+#endif
+  return SD_disk_ioctl(drv, ctrl, buff);
+}
+
+
+#if _DISK_ARRAY
+/* Transfers of one round on the members of the array. Each member gets */
+/* one multiple block transfer of consecutive sectors per round.        */
+#define ARR_NVEC  16    /* Segments per member and round */
+
+typedef struct {
+  DWORD sect;          /* Start sector on the member */
+  DWORD cnt;          /* Number of sectors */
+  UINT  n;          /* Number of segments (0:no transfer) */
+  DISKVEC vec[ARR_NVEC];    /* Segments */
+#if _DISK_ASYNC
+  DISKREQ req;        /* Request to the member's server */
+#endif
+} ARRXFER;
+
+
+/*-----------------------------------------------------------------------*/
+/* Run the member transfers of a round in parallel                       */
+/*-----------------------------------------------------------------------*/
+/* The transfers of the members attached to a disk server are queued to */
+/* them first, the others are done here in the meantime.                */
+
+static
+DRESULT arr_round (
+  BYTE wr,      /* 0:Read, 1:Write */
+  ARRXFER *x      /* Member transfers (_DISK_ARRAY items) */
+)
+{
+  DRESULT res = RES_OK, r;
+  BYTE m;
+
+
+#if _DISK_ASYNC
+  for (m = 0; m < _DISK_ARRAY; m++) {
+    if (!x[m].n || !Srv[m].attached) continue;
+    x[m].req.op = wr ? DISK_OP_WRITEV : DISK_OP_READV;
+    x[m].req.drv = m;
+    x[m].req.buff = (BYTE*)x[m].vec;
+    x[m].req.sector = x[m].sect;
+    x[m].req.count = (BYTE)x[m].n;
+    disk_submit(&x[m].req);
+  }
+#endif
+  for (m = 0; m < _DISK_ARRAY; m++) {
+    if (!x[m].n) continue;
+#if _DISK_ASYNC
+    if (Srv[m].attached) continue;
+#endif
+#if !_READONLY
+    if (wr)
+      r = vec_write(m, x[m].vec, x[m].n, x[m].sect);
+    else
+#endif
+      r = vec_read(m, x[m].vec, x[m].n, x[m].sect);
+    if (res == RES_OK) res = r;
+    x[m].n = 0;
+  }
+#if _DISK_ASYNC
+  for (m = 0; m < _DISK_ARRAY; m++) {  /* Collect the queued ones */
+    if (!x[m].n) continue;
+    r = disk_wait(&x[m].req);
+    if (res == RES_OK) res = r;
+    x[m].n = 0;
+  }
+#endif
+  return res;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Read/Write sectors of the array                                       */
+/*-----------------------------------------------------------------------*/
+/* Striped: sector v is sector (v / S / N) * S + v % S of member         */
+/* v / S % N (S:_DISK_STRIPE, N:_DISK_ARRAY). Mirrored: every member     */
+/* holds sector v, writes go to all members and a read is split into N   */
+/* parts read from different members (or from member 'only' if it is a  */
+/* valid member number).                                                 */
+
+static
+DRESULT arr_xfer (
+  BYTE wr,      /* 0:Read, 1:Write */
+  const DISKVEC *vec,  /* Segment list */
+  UINT nvec,      /* Number of segments */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE only      /* Member to read from (mirror), 0xFF:any */
+)
+{
+  ARRXFER x[_DISK_ARRAY];
+  DRESULT res;
+  DWORD v = sector, ms, n, ofs;
+  UINT i, k;
+  BYTE m, m1, *b;
+#if _DISK_MIRROR
+  DWORD part = 0;
+
+
+  for (i = 0; i < nvec; i++) part += vec[i].count;
+  part = (part + _DISK_ARRAY - 1) / _DISK_ARRAY;  /* Sectors read from each member */
+#else
+
+
+  (void)only;
+#endif
+  for (m = 0; m < _DISK_ARRAY; m++) x[m].n = 0;
+
+  for (i = 0; i < nvec; i++) {
+    for (ofs = 0; ofs < vec[i].count; ofs += n, v += n) {
+      b = vec[i].buff + ofs * 512;
+      n = vec[i].count - ofs;
+#if _DISK_MIRROR
+      ms = v;
+      if (wr) {          /* Write to all members */
+        m = 0; m1 = _DISK_ARRAY;
+      } else if (only < _DISK_ARRAY) {
+        m = only; m1 = m + 1;
+      } else {          /* Read each part from another member */
+        m = (v - sector) / part; m1 = m + 1;
+        if (n > part - (v - sector) % part) n = part - (v - sector) % part;
+      }
+#else
+      m = v / _DISK_STRIPE % _DISK_ARRAY; m1 = m + 1;
+      ms = v / _DISK_STRIPE / _DISK_ARRAY * _DISK_STRIPE + v % _DISK_STRIPE;
+      if (n > _DISK_STRIPE - v % _DISK_STRIPE) n = _DISK_STRIPE - v % _DISK_STRIPE;
+#endif
+      for ( ; m < m1; m++) {
+        if (x[m].n) {
+          k = x[m].n - 1;
+          if (x[m].sect + x[m].cnt == ms && x[m].vec[k].buff + x[m].vec[k].count * 512 == b) {
+            x[m].vec[k].count += n;    /* Extend the last segment */
+            x[m].cnt += n;
+            continue;
+          }
+          if (x[m].sect + x[m].cnt != ms || x[m].n == ARR_NVEC) {  /* Not consecutive or no room, run the round */
+            res = arr_round(wr, x);
+            if (res != RES_OK) return res;
+          }
+        }
+        if (!x[m].n) {
+          x[m].sect = ms;
+          x[m].cnt = 0;
+        }
+        x[m].vec[x[m].n].buff = b;
+        x[m].vec[x[m].n].count = n;
+        x[m].n++;
+        x[m].cnt += n;
+      }
+    }
+  }
+  return arr_round(wr, x);
+}
+
+
+static
+DRESULT arr_rw (
+  BYTE wr,      /* 0:Read, 1:Write */
+  const DISKVEC *vec,  /* Segment list */
+  UINT nvec,      /* Number of segments */
+  DWORD sector    /* Start sector number (LBA) */
+)
+{
+  DRESULT res;
+#if _DISK_MIRROR
+  BYTE m;
+#endif
+
+
+  res = arr_xfer(wr, vec, nvec, sector, 0xFF);
+#if _DISK_MIRROR
+  for (m = 0; !wr && res != RES_OK && m < _DISK_ARRAY; m++)
+    res = arr_xfer(0, vec, nvec, sector, m);  /* Read failed, try the whole range on each member */
+#endif
+  return res;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Stream sectors of the array                                           */
+/*-----------------------------------------------------------------------*/
+/* The consumer needs the sectors in order, so the members are read one  */
+/* after another: a stripe run at a time, or all from the first member  */
+/* of a mirror.                                                          */
+
+static
+DRESULT arr_read_chan (
+  DISKCHAN c,      /* Streaming channel end to the consumer */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count (1..255) */
+)
+{
+#if _DISK_MIRROR
+  return drv_read_chan(0, c, sector, count);
+#else
+  DRESULT res = RES_OK, r;
+  BYTE n;
+
+
+  for ( ; count; count -= n, sector += n) {
+    n = _DISK_STRIPE - sector % _DISK_STRIPE;
+    if (n > count) n = count;
+    r = drv_read_chan((BYTE)(sector / _DISK_STRIPE % _DISK_ARRAY), c,
+      sector / _DISK_STRIPE / _DISK_ARRAY * _DISK_STRIPE + sector % _DISK_STRIPE, n);
+    if (res == RES_OK) res = r;  /* A failed run is sent as zero words, go on with the next */
+  }
+  return res;
+#endif
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Initialize the members or get their status                            */
+/*-----------------------------------------------------------------------*/
+
+static
+DSTATUS arr_status (
+  BYTE init    /* 1:Initialize, 0:Get status */
+)
+{
+  DSTATUS st = 0;
+  BYTE m;
+#if _DISK_ASYNC
+  DISKREQ req;
+#endif
+
+
+  for (m = 0; m < _DISK_ARRAY; m++) {
+#if _DISK_ASYNC
+    if (Srv[m].attached) {
+      srv_call(&req, init ? DISK_OP_INIT : DISK_OP_STATUS, m, 0, 0, 0);
+      st |= req.stat;
+      continue;
+    }
+#endif
+    st |= init ? SD_disk_initialize(m) : SD_disk_status(m);
+  }
+  return st;    /* The array is ready when all members are */
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Control the array                                                     */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT arr_ioctl (
+  BYTE ctrl,      /* Control code */
+  BYTE *buff      /* Buffer to send/receive control data */
+)
+{
+  DRESULT res = RES_OK, r;
+  DWORD d, v, rng[2];
+  BYTE m;
+
+
+  switch (ctrl) {
+  case GET_SECTOR_COUNT :
+  case GET_BLOCK_SIZE :
+    v = (ctrl == GET_SECTOR_COUNT) ? 0xFFFFFFFF : 0;
+    for (m = 0; m < _DISK_ARRAY; m++) {  /* Smallest card, largest erase block */
+      res = drv_ioctl(m, ctrl, (BYTE*)&d);
+      if (res != RES_OK) return res;
+      if (ctrl == GET_SECTOR_COUNT ? d < v : d > v) v = d;
+    }
+#if !_DISK_MIRROR
+    if (ctrl == GET_SECTOR_COUNT)
+      v = v / _DISK_STRIPE * _DISK_STRIPE * _DISK_ARRAY;  /* Whole stripes */
+    else
+      v *= _DISK_ARRAY;    /* An erase block on each member */
+#endif
+    *(DWORD*)buff = v;
+    return RES_OK;
+
+  case CTRL_SYNC :
+    for (m = 0; m < _DISK_ARRAY; m++) {
+      r = drv_ioctl(m, ctrl, buff);
+      if (res == RES_OK) res = r;
+    }
+    return res;
+
+  case CTRL_ERASE_SECTOR :
+#if _DISK_MIRROR
+    rng[0] = ((DWORD*)buff)[0];
+    rng[1] = ((DWORD*)buff)[1];
+#else
+    d = (DWORD)_DISK_STRIPE * _DISK_ARRAY;  /* Whole stripe rows of the range */
+    rng[0] = (((DWORD*)buff)[0] + d - 1) / d * _DISK_STRIPE;
+    rng[1] = (((DWORD*)buff)[1] + 1) / d * _DISK_STRIPE;
+    if (rng[0] >= rng[1]) return RES_OK;
+    rng[1]--;
+#endif
+    for (m = 0; m < _DISK_ARRAY; m++) {
+      r = drv_ioctl(m, ctrl, (BYTE*)rng);
+      if (res == RES_OK) res = r;
+    }
+    return res;
+  }
+  return drv_ioctl(0, ctrl, buff);  /* Card information of the first member */
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Get or reset the I/O statistics of the array                          */
+/*-----------------------------------------------------------------------*/
+/* The counters of the members are summed, so they count the transfers   */
+/* of the members. The worst-case busy time is the largest one.          */
+
+static
+DRESULT arr_iostat (
+  BYTE ctrl,      /* MMC_GET_IOSTAT or MMC_CLR_IOSTAT */
+  BYTE *buff      /* Buffer to return the statistics (DISKSTAT) */
+)
+{
+  DISKSTAT *st = (DISKSTAT*)buff, ms;
+  DRESULT res;
+  BYTE m;
+  UINT i;
+
+
+  res = SD_disk_ioctl(0, ctrl, buff);
+  for (m = 1; res == RES_OK && m < _DISK_ARRAY; m++) {
+    if (ctrl == MMC_CLR_IOSTAT) {
+      res = SD_disk_ioctl(m, ctrl, buff);
+      continue;
+    }
+    res = SD_disk_ioctl(m, ctrl, (BYTE*)&ms);
+    if (res != RES_OK) break;
+    for (i = 0; i < DISKSTAT_BUCKETS; i++) {
+      st->rd_hist[i] += ms.rd_hist[i];
+      st->wr_hist[i] += ms.wr_hist[i];
+      st->busy_hist[i] += ms.busy_hist[i];
+    }
+    st->rd_blocks += ms.rd_blocks;
+    st->wr_blocks += ms.wr_blocks;
+    st->rd_bytes += ms.rd_bytes;
+    st->wr_bytes += ms.wr_bytes;
+    st->retries += ms.retries;
+    st->timeouts += ms.timeouts;
+    if (ms.wr_busy_max > st->wr_busy_max) st->wr_busy_max = ms.wr_busy_max;
+  }
+  return res;
+}
+#endif
+
+
+/*-----------------------------------------------------------------------*/
+/* Read/Write sectors on the driver, on the server or on the array       */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT dev_read (
+  BYTE drv,      /* Physical drive number */
+  BYTE *buff,      /* Pointer to the data buffer to store read data */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count (1..255) */
+)
+{
+#if _DISK_ASYNC
+  DISKREQ req;
+#endif
+#if _DISK_ARRAY
+  DISKVEC v;
+
+
+  if (ARR(drv)) {
+    v.buff = buff; v.count = count;
+    return arr_rw(0, &v, 1, sector);
+  }
+#endif
+#if _DISK_ASYNC
+  if (Srv[drv].attached)
+    return srv_call(&req, DISK_OP_READ, drv, buff, sector, count);
+#endif
+  return SD_disk_read(drv, buff, sector, count);
+}
+
+#if !_READONLY
+static
+DRESULT dev_write (
+  BYTE drv,      /* Physical drive number */
+  const BYTE *buff,  /* Pointer to the data to be written */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count (1..255) */
+)
+{
+#if _DISK_ASYNC
+  DISKREQ req;
+#endif
+#if _DISK_ARRAY
+  DISKVEC v;
+
+
+  if (ARR(drv)) {
+    v.buff = (BYTE*)buff; v.count = count;
+    return arr_rw(1, &v, 1, sector);
+  }
+#endif
+#if _DISK_ASYNC
+  if (Srv[drv].attached)
+    return srv_call(&req, DISK_OP_WRITE, drv, (BYTE*)buff, sector, count);
+#endif
+  return SD_disk_write(drv, buff, sector, count);
+}
+#endif
+
+static
+DRESULT dev_ioctl (
+  BYTE drv,      /* Physical drive number */
+  BYTE ctrl,      /* Control code */
+  BYTE *buff      /* Buffer to send/receive control data */
+)
+{
+#if _DISK_ARRAY
+  if (ARR(drv)) return arr_ioctl(ctrl, buff);
+#endif
+  return drv_ioctl(drv, ctrl, buff);
+}
+
+
+#if _DISK_COALESCE && !_READONLY
+/* Write coalescing buffer. Contiguous single sector writes are held here */
+/* and submitted to the card as one multiple block write.                 */
+static struct {
+  DWORD sect;                       /* First sector held */
+  BYTE  n;                          /* Number of sectors held (0:empty) */
+  BYTE  buf[_DISK_COALESCE * 512];  /* Data of the held sectors */
+} Wcb[_DRIVES];
+
+
+/*-----------------------------------------------------------------------*/
+/* Write the held sectors to the card                                    */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT wcb_flush (
+  BYTE drv    /* Physical drive number */
+)
+{
+  DRESULT res = RES_OK;
+
+
+  if (Wcb[drv].n) {
+    res = dev_write(drv, Wcb[drv].buf, Wcb[drv].sect, Wcb[drv].n);
+    Wcb[drv].n = 0;    /* The data is dropped on error as well, the error is reported to the caller */
+  }
+  return res;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Flush the held sectors if they overlap a sector range                 */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT wcb_flush_range (
+  BYTE drv,      /* Physical drive number */
+  DWORD sector,    /* Start sector of the range */
+  DWORD count      /* Number of sectors of the range */
+)
+{
+  if (Wcb[drv].n && sector < Wcb[drv].sect + Wcb[drv].n && sector + count > Wcb[drv].sect)
+    return wcb_flush(drv);
+  return RES_OK;
+}
+#endif
+
+
+/*-----------------------------------------------------------------------*/
+/* Read sectors from the card                                            */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT card_read (
+  BYTE drv,      /* Physical drive number */
+  BYTE *buff,      /* Pointer to the data buffer to store read data */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count (1..255) */
+)
+{
+#if _DISK_COALESCE && !_READONLY
+  DRESULT res;
+
+
+  res = wcb_flush_range(drv, sector, count);  /* The card has to see the held data first */
+  if (res != RES_OK) return res;
+#endif
+  return dev_read(drv, buff, sector, count);
+}
+
+
+#if _DISK_PREFETCH
+/* Read-ahead buffer. A read stream is detected per drive and the sectors */
+/* ahead of it are fetched with one multiple block read.                  */
+/* With a disk server, the sectors following the front buffer are read  */
+/* into the back buffer on the server while the front one is consumed.   */
+static struct {
+  DWORD sect;      /* First sector in the front buffer */
+  DWORD next;      /* End of the last request of the stream */
+  DWORD alt;      /* End of the last request out of the stream */
+  BYTE  n;        /* Number of valid sectors in the front buffer (0:empty) */
+  BYTE  k;        /* Read-ahead depth (2.._DISK_PREFETCH) */
+  BYTE  front;      /* Index of the front buffer */
+#if _DISK_ASYNC
+  DISKREQ ahead;      /* Read-ahead request into the back buffer (op = 0:none) */
+#endif
+  BYTE  buf[_DISK_ASYNC ? 2 : 1][_DISK_PREFETCH * 512];  /* Data of the read-ahead sectors */
+} Pfb[_DRIVES];
+
+
+#if _DISK_ASYNC
+/*-----------------------------------------------------------------------*/
+/* Start reading the sectors that follow the front buffer                */
+/*-----------------------------------------------------------------------*/
+
+static
+void pfb_ahead (
+  BYTE drv    /* Physical drive number */
+)
+{
+  DWORD sector;
+
+
+  if (!SRV(drv) || Pfb[drv].ahead.op || !Pfb[drv].n) return;
+
+  sector = Pfb[drv].sect + Pfb[drv].n;
+#if _DISK_COALESCE && !_READONLY
+  if (wcb_flush_range(drv, sector, Pfb[drv].k) != RES_OK) return;
+#endif
+  Pfb[drv].ahead.op = DISK_OP_READ;
+  Pfb[drv].ahead.drv = drv;
+  Pfb[drv].ahead.buff = Pfb[drv].buf[Pfb[drv].front ^ 1];
+  Pfb[drv].ahead.sector = sector;
+  Pfb[drv].ahead.count = Pfb[drv].k;
+  disk_submit(&Pfb[drv].ahead);
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Wait for the read-ahead into the back buffer and drop it              */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT pfb_drop_ahead (
+  BYTE drv    /* Physical drive number */
+)
+{
+  DRESULT res = RES_ERROR;
+
+
+  if (Pfb[drv].ahead.op) {
+    res = disk_wait(&Pfb[drv].ahead);
+    Pfb[drv].ahead.op = 0;
+  }
+  return res;
+}
+#endif
+
+
+/*-----------------------------------------------------------------------*/
+/* Read sectors through the read-ahead buffer                            */
+/*-----------------------------------------------------------------------*/
+/* A request that starts within the depth of the read-ahead window past  */
+/* the end of the previous one continues the stream, so a constant       */
+/* forward stride is followed as well as a strictly sequential access.   */
+/* Requests out of the stream (e.g. FAT and directory accesses between   */
+/* the data sectors) do not break it. A request that continues one of    */
+/* them starts a new stream. The depth is doubled each time the stream   */
+/* runs out of the buffer (or catches up with the read-ahead on the      */
+/* server) and halved when a new stream starts.                          */
+
+static
+DRESULT pfb_read (
+  BYTE drv,      /* Physical drive number */
+  BYTE *buff,      /* Pointer to the data buffer to store read data */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count (1..255) */
+)
+{
+  DRESULT res;
+  DWORD ofs;
+  BYTE seq, *buf;
+
+
+  if (Pfb[drv].k < 2) Pfb[drv].k = 2;
+
+  /* Track the read stream */
+  seq = (sector - Pfb[drv].next < Pfb[drv].k);
+  if (!seq && sector == Pfb[drv].alt) {  /* A new stream */
+    seq = 1;
+    if (Pfb[drv].k > 2) Pfb[drv].k >>= 1;
+  }
+  if (seq)
+    Pfb[drv].next = sector + count;
+  else
+    Pfb[drv].alt = sector + count;
+
+  /* Serve the request from the front buffer if it holds all the sectors */
+  ofs = sector - Pfb[drv].sect;
+  if (Pfb[drv].n && ofs < Pfb[drv].n && count <= Pfb[drv].n - ofs) {
+    memcpy(buff, &Pfb[drv].buf[Pfb[drv].front][ofs * 512], count * 512);
+#if _DISK_ASYNC
+    pfb_ahead(drv);
+#endif
+    return RES_OK;
+  }
+
+  /* Random and large reads go to the card directly */
+  if (!seq || count >= Pfb[drv].k)
+    return card_read(drv, buff, sector, count);
+
+#if _DISK_ASYNC
+  /* Swap in the back buffer if the server has read (or is reading) the sectors */
+  if (Pfb[drv].ahead.op) {
+    if (!disk_done(&Pfb[drv].ahead) && Pfb[drv].k <= _DISK_PREFETCH / 2)
+      Pfb[drv].k <<= 1;      /* The stream caught up with the read-ahead, read further ahead */
+    ofs = sector - Pfb[drv].ahead.sector;
+    if (pfb_drop_ahead(drv) == RES_OK && ofs < Pfb[drv].ahead.count && count <= Pfb[drv].ahead.count - ofs) {
+      Pfb[drv].front ^= 1;
+      Pfb[drv].sect = Pfb[drv].ahead.sector;
+      Pfb[drv].n = Pfb[drv].ahead.count;
+      memcpy(buff, &Pfb[drv].buf[Pfb[drv].front][ofs * 512], count * 512);
+      pfb_ahead(drv);
+      return RES_OK;
+    }
+  }
+  else
+#endif
+  if (Pfb[drv].n && ofs >= Pfb[drv].n && Pfb[drv].k <= _DISK_PREFETCH / 2)
+    Pfb[drv].k <<= 1;      /* The stream ran out of the buffer, read further ahead */
+
+  /* Refill the front buffer from the requested sector on */
+  Pfb[drv].n = 0;
+  buf = Pfb[drv].buf[Pfb[drv].front];
+  res = card_read(drv, buf, sector, Pfb[drv].k);
+  if (res != RES_OK)      /* The read-ahead may go past the end of the card */
+    return card_read(drv, buff, sector, count);
+  Pfb[drv].sect = sector;
+  Pfb[drv].n = Pfb[drv].k;
+  memcpy(buff, buf, count * 512);
+#if _DISK_ASYNC
+  pfb_ahead(drv);
+#endif
+
+  return RES_OK;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Drop the read-ahead sectors overlapping a written range               */
+/*-----------------------------------------------------------------------*/
+
+static
+void pfb_invalidate (
+  BYTE drv,      /* Physical drive number */
+  DWORD sector,    /* Start sector of the range */
+  DWORD count      /* Number of sectors of the range */
+)
+{
+  if (Pfb[drv].n && sector < Pfb[drv].sect + Pfb[drv].n && sector + count > Pfb[drv].sect)
+    Pfb[drv].n = 0;
+#if _DISK_ASYNC
+  if (Pfb[drv].ahead.op && sector < Pfb[drv].ahead.sector + Pfb[drv].ahead.count && sector + count > Pfb[drv].ahead.sector)
+    pfb_drop_ahead(drv);
+#endif
+}
+#endif
+
+
+#if _DISK_ERASE
+/* Erase ranges held for the idle time. With a disk server, the table is */
+/* shared by the server and the client core and guarded by its lock.     */
+static struct {
+  DWORD st[_DISK_ERASE];  /* Start sectors */
+  DWORD ed[_DISK_ERASE];  /* End sectors */
+  BYTE  n;        /* Number of held ranges */
+} Ers[_DRIVES];
+
+
+static
+void ers_lock (
+  BYTE drv    /* Physical drive number */
+)
+{
+  (void)drv;
+#if _DISK_ASYNC
+  if (SRV(drv)) hwlock_acquire(Srv[drv].lock);
+#endif
+}
+
+static
+void ers_unlock (
+  BYTE drv    /* Physical drive number */
+)
+{
+  (void)drv;
+#if _DISK_ASYNC
+  if (SRV(drv)) hwlock_release(Srv[drv].lock);
+#endif
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Hold an erase range (the caller holds the lock)                       */
+/*-----------------------------------------------------------------------*/
+
+static
+int ers_put (    /* 1:Held, 0:Table full */
+  BYTE drv,      /* Physical drive number */
+  DWORD st,      /* Start sector */
+  DWORD ed      /* End sector */
+)
+{
+  BYTE n = Ers[drv].n;
+
+
+  if (n && Ers[drv].ed[n - 1] + 1 == st) {  /* Extend the last range if contiguous */
+    Ers[drv].ed[n - 1] = ed;
+    return 1;
+  }
+  if (n == _DISK_ERASE) return 0;
+  Ers[drv].st[n] = st;
+  Ers[drv].ed[n] = ed;
+  Ers[drv].n = n + 1;
+  return 1;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Take the oldest erase range off the table (the caller holds the lock) */
+/*-----------------------------------------------------------------------*/
+
+static
+int ers_take (    /* 1:Taken, 0:Table empty */
+  BYTE drv,      /* Physical drive number */
+  DWORD *rng      /* Start and end sector of the range taken */
+)
+{
+  BYTE i;
+
+
+  if (!Ers[drv].n) return 0;
+  rng[0] = Ers[drv].st[0];
+  rng[1] = Ers[drv].ed[0];
+  for (i = 1; i < Ers[drv].n; i++) {
+    Ers[drv].st[i - 1] = Ers[drv].st[i];
+    Ers[drv].ed[i - 1] = Ers[drv].ed[i];
+  }
+  Ers[drv].n--;
+  return 1;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Cancel the held erase ranges overlapping a written range              */
+/*-----------------------------------------------------------------------*/
+
+static
+void ers_cancel (
+  BYTE drv,      /* Physical drive number */
+  DWORD sector,    /* Start sector of the written range */
+  DWORD count      /* Number of sectors of the written range */
+)
+{
+  BYTE i, j;
+
+
+  ers_lock(drv);
+  for (i = j = 0; i < Ers[drv].n; i++) {
+    if (sector <= Ers[drv].ed[i] && sector + count > Ers[drv].st[i]) continue;  /* Overlapping? */
+    Ers[drv].st[j] = Ers[drv].st[i];
+    Ers[drv].ed[j] = Ers[drv].ed[i];
+    j++;
+  }
+  Ers[drv].n = j;
+  ers_unlock(drv);
+}
+#endif
+
+
+/* Erase block size of each drive in unit of sector (0:not known yet) */
+static DWORD Au[_DRIVES];
+
+
+/*-----------------------------------------------------------------------*/
+/* Erase the whole erase blocks in a sector range                        */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT erase_range (
+  BYTE drv,      /* Physical drive number */
+  const DWORD *rng  /* Start and end sector of the range */
+)
+{
+  DRESULT res;
+  DWORD r[2], au;
+#if _DISK_ERASE
+  DWORD old[2];
+#if _DISK_ASYNC
+  BYTE s = 0;
+#endif
+#endif
+
+
+  if (!Au[drv]) {    /* Get the erase block size at the first erase */
+    res = dev_ioctl(drv, GET_BLOCK_SIZE, (BYTE*)&au);
+    if (res != RES_OK) return res;
+    Au[drv] = au ? au : 1;
+  }
+  au = Au[drv];
+  r[0] = (rng[0] + au - 1) / au * au;  /* Start of the first erase block in the range */
+  r[1] = (rng[1] + 1) / au * au;      /* End of the last erase block in the range */
+  if (r[0] >= r[1]) return RES_OK;    /* No whole erase block in the range */
+  r[1]--;
+
+#if _DISK_COALESCE && !_READONLY
+  res = wcb_flush_range(drv, r[0], r[1] - r[0] + 1);  /* The held data is written before the erase */
+  if (res != RES_OK) return res;
+#endif
+#if _DISK_PREFETCH
+  pfb_invalidate(drv, r[0], r[1] - r[0] + 1);
+#endif
+#if _DISK_ERASE
+  for (;;) {
+    ers_lock(drv);
+    if (ers_put(drv, r[0], r[1])) break;
+    ers_take(drv, old);      /* Table full, erase the oldest range at once */
+    ers_unlock(drv);
+    res = dev_ioctl(drv, CTRL_ERASE_SECTOR, (BYTE*)old);
+    if (res != RES_OK) return res;
+  }
+#if _DISK_ASYNC
+  if (SRV(drv) && Srv[drv].sleeping) {
+    Srv[drv].sleeping = 0;
+    s = 1;
+  }
+#endif
+  ers_unlock(drv);
+#if _DISK_ASYNC
+  if (s) disk_chan_signal(Srv[drv].c);  /* Wake up the server to erase in its idle time */
+#endif
+  return RES_OK;
+#else
+  return dev_ioctl(drv, CTRL_ERASE_SECTOR, (BYTE*)r);
+#endif
+}
+
+
+
+/*--------------------------------------------------------------------------
+
+   Public Functions
+
+---------------------------------------------------------------------------*/
+
+#if _DISK_ASYNC
+/*-----------------------------------------------------------------------*/
+/* Disk server                                                           */
+/*-----------------------------------------------------------------------*/
+/* Runs on its own core and executes the requests queued for the drive   */
+/* in order. It never returns.                                           */
+
+void disk_server (
+  chanend c,    /* Server end of the channel to the client */
+  BYTE drv    /* Physical drive number */
+)
+{
+  DISKREQ *req;
+  BYTE w;
+#if _DISK_ERASE
+  DWORD rng[2];
+#endif
+
+
+  for (;;) {
+    disk_chan_wait(c);    /* Sleep until the client rings the doorbell */
+    for (;;) {
+      hwlock_acquire(Srv[drv].lock);
+      if (Srv[drv].head == Srv[drv].tail) {  /* Queue empty? */
+#if _DISK_ERASE
+        if (!ARR(drv) && ers_take(drv, rng)) {  /* Erase a held range in the idle time */
+          hwlock_release(Srv[drv].lock);
+          SD_disk_ioctl(drv, CTRL_ERASE_SECTOR, (BYTE*)rng);
+          continue;
+        }
+#endif
+        Srv[drv].sleeping = 1;
+        hwlock_release(Srv[drv].lock);
+        break;
+      }
+      req = Srv[drv].q[Srv[drv].head % _DISK_QUEUE];
+      hwlock_release(Srv[drv].lock);
+
+      srv_exec(req);
+
+      hwlock_acquire(Srv[drv].lock);
+      Srv[drv].head++;
+      req->state = DISKREQ_DONE;
+      w = req->wait;
+      hwlock_release(Srv[drv].lock);
+      if (w) disk_chan_signal(c);  /* Wake up the client waiting for it */
+    }
+  }
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Attach the calling core as the client of a disk server                */
+/*-----------------------------------------------------------------------*/
+
+void disk_attach (
+  BYTE drv,    /* Physical drive number */
+  chanend c    /* Client end of the channel to the server */
+)
+{
+  if (drv >= _DRIVES || Srv[drv].attached) return;
+
+  Srv[drv].lock = hwlock_alloc();
+  if (Srv[drv].lock == HWLOCK_NONE) return;  /* No lock left, the drive is used directly */
+  Srv[drv].c = c;
+  Srv[drv].head = Srv[drv].tail = 0;
+  Srv[drv].sleeping = 1;    /* The server starts waiting for the first doorbell */
+  Srv[drv].attached = 1;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Submit a request                                                      */
+/*-----------------------------------------------------------------------*/
+/* The request is queued and the function returns. It waits only when    */
+/* _DISK_QUEUE requests are in flight, until the oldest one completes.   */
+
+DRESULT disk_submit (
+  DISKREQ* req    /* Request to be queued */
+)
+{
+  BYTE drv = req->drv, s;
+  DISKREQ *old;
+
+
+  if (drv >= _DRIVES || !Srv[drv].attached) return RES_NOTRDY;
+
+  for (;;) {
+    hwlock_acquire(Srv[drv].lock);
+    if ((BYTE)(Srv[drv].tail - Srv[drv].head) < _DISK_QUEUE) break;
+    old = Srv[drv].q[Srv[drv].head % _DISK_QUEUE];
+    hwlock_release(Srv[drv].lock);
+    disk_wait(old);      /* Queue full, wait for a free entry */
+  }
+  req->state = DISKREQ_QUEUED;
+  req->wait = 0;
+  Srv[drv].q[Srv[drv].tail++ % _DISK_QUEUE] = req;
+  s = Srv[drv].sleeping;
+  Srv[drv].sleeping = 0;
+  hwlock_release(Srv[drv].lock);
+  if (s) disk_chan_signal(Srv[drv].c);  /* Ring the doorbell */
+
+  return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Wait for completion of a request                                      */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_wait (
+  DISKREQ* req    /* Submitted request */
+)
+{
+  BYTE drv = req->drv;
+
+
+  hwlock_acquire(Srv[drv].lock);
+  if (req->state == DISKREQ_DONE) {
+    hwlock_release(Srv[drv].lock);
+  } else {
+    req->wait = 1;
+    hwlock_release(Srv[drv].lock);
+    disk_chan_wait(Srv[drv].c);  /* Sleep until the server signals the completion */
+  }
+  return req->res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Check if a request is completed                                       */
+/*-----------------------------------------------------------------------*/
+
+int disk_done (
+  DISKREQ* req    /* Submitted request */
+)
+{
+  return req->state == DISKREQ_DONE;
+}
+
+
+
+#endif
+
+/*-----------------------------------------------------------------------*/
+/* Initialize Disk Drive                                                 */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_initialize (
+  BYTE drv    /* Physical drive number */
+)
+{
+#if _DISK_ASYNC
+  DISKREQ req;
+#endif
+
+
+  if (BAD_DRV(drv)) return STA_NOINIT;
+
+  Au[drv] = 0;
+#if _DISK_ERASE
+  ers_lock(drv);
+  Ers[drv].n = 0;    /* Ranges of a previous card are not erased on a new one */
+  ers_unlock(drv);
+#endif
+#if _DISK_COALESCE && !_READONLY
+  Wcb[drv].n = 0;    /* Data held for a previous card cannot be written to a new one */
+#endif
+#if _DISK_PREFETCH
+  Pfb[drv].n = 0;
+#if _DISK_ASYNC
+  pfb_drop_ahead(drv);
+#endif
+#endif
+#if _DISK_ARRAY
+  if (ARR(drv)) return arr_status(1);
+#endif
+#if _DISK_ASYNC
+  if (Srv[drv].attached) {
+    srv_call(&req, DISK_OP_INIT, drv, 0, 0, 0);
+    return req.stat;
+  }
+#endif
+  return SD_disk_initialize(drv);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get Disk Status                                                       */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_status (
+  BYTE drv    /* Physical drive number */
+)
+{
+#if _DISK_ASYNC
+  DISKREQ req;
+#endif
+
+
+  if (BAD_DRV(drv)) return STA_NOINIT;
+
+#if _DISK_ARRAY
+  if (ARR(drv)) return arr_status(0);
+#endif
+#if _DISK_ASYNC
+  if (Srv[drv].attached) {
+    srv_call(&req, DISK_OP_STATUS, drv, 0, 0, 0);
+    return req.stat;
+  }
+#endif
+  return SD_disk_status(drv);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s)                                                        */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_read (
+  BYTE drv,      /* Physical drive number */
+  BYTE buff[],    /* Pointer to the data buffer to store read data */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count (1..255) */
+)
+{
+  if (BAD_DRV(drv)) return RES_PARERR;
+  if (!count) return RES_PARERR;
+
+#if _DISK_PREFETCH
+  return pfb_read(drv, buff, sector, count);
+#else
+  return card_read(drv, buff, sector, count);
+#endif
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s)                                                       */
+/*-----------------------------------------------------------------------*/
+
+#if _READONLY == 0
+DRESULT disk_write (
+  BYTE drv,      /* Physical drive number */
+  const BYTE buff[],  /* Pointer to the data to be written */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count (1..255) */
+)
+{
+#if _DISK_COALESCE
+  DRESULT res;
+  DWORD ofs;
+#endif
+
+
+  if (BAD_DRV(drv)) return RES_PARERR;
+  if (!count) return RES_PARERR;
+
+#if _DISK_ERASE
+  ers_cancel(drv, sector, count);
+#endif
+#if _DISK_PREFETCH
+  pfb_invalidate(drv, sector, count);
+#endif
+#if _DISK_COALESCE
+  if (count == 1) {
+    ofs = sector - Wcb[drv].sect;
+    if (!Wcb[drv].n || ofs > Wcb[drv].n) {  /* Not within or next to the held sectors? */
+      res = wcb_flush(drv);          /* Flush on a gap and start a new run */
+      if (res != RES_OK) return res;
+      Wcb[drv].sect = sector;
+      ofs = 0;
+    }
+    memcpy(&Wcb[drv].buf[ofs * 512], buff, 512);  /* Append or overwrite the sector */
+    if (ofs == Wcb[drv].n) Wcb[drv].n++;
+    if (Wcb[drv].n == _DISK_COALESCE)  /* Submit when the buffer is full */
+      return wcb_flush(drv);
+    return RES_OK;
+  }
+  res = wcb_flush(drv);    /* Keep the write order of the held and the new sectors */
+  if (res != RES_OK) return res;
+#endif
+  return dev_write(drv, buff, sector, count);
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Sectors into a Segment List                                      */
+/*-----------------------------------------------------------------------*/
+/* The consecutive sectors from the start sector on fill the segments in */
+/* order, with a single multiple block read on the card.                 */
+
+DRESULT disk_readv (
+  BYTE drv,      /* Physical drive number */
+  const DISKVEC *vec,  /* Segment list */
+  UINT nvec,      /* Number of segments (1..255) */
+  DWORD sector    /* Start sector number (LBA) */
+)
+{
+  DWORD cnt;
+  UINT i;
+#if _DISK_COALESCE && !_READONLY
+  DRESULT res;
+#endif
+#if _DISK_ASYNC
+  DISKREQ req;
+#endif
+
+
+  if (BAD_DRV(drv)) return RES_PARERR;
+  if (!nvec || nvec > 255) return RES_PARERR;
+  for (cnt = i = 0; i < nvec; i++) cnt += vec[i].count;
+  if (!cnt) return RES_PARERR;
+
+#if _DISK_COALESCE && !_READONLY
+  res = wcb_flush_range(drv, sector, cnt);  /* The card has to see the held data first */
+  if (res != RES_OK) return res;
+#endif
+#if _DISK_ARRAY
+  if (ARR(drv)) return arr_rw(0, vec, nvec, sector);
+#endif
+#if _DISK_ASYNC
+  if (Srv[drv].attached)
+    return srv_call(&req, DISK_OP_READV, drv, (BYTE*)vec, sector, (BYTE)nvec);
+#endif
+  return vec_read(drv, vec, nvec, sector);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write Sectors from a Segment List                                     */
+/*-----------------------------------------------------------------------*/
+
+#if _READONLY == 0
+DRESULT disk_writev (
+  BYTE drv,      /* Physical drive number */
+  const DISKVEC *vec,  /* Segment list */
+  UINT nvec,      /* Number of segments (1..255) */
+  DWORD sector    /* Start sector number (LBA) */
+)
+{
+  DWORD cnt;
+  UINT i;
+#if _DISK_COALESCE
+  DRESULT res;
+#endif
+#if _DISK_ASYNC
+  DISKREQ req;
+#endif
+
+
+  if (BAD_DRV(drv)) return RES_PARERR;
+  if (!nvec || nvec > 255) return RES_PARERR;
+  for (cnt = i = 0; i < nvec; i++) cnt += vec[i].count;
+  if (!cnt) return RES_PARERR;
+
+#if _DISK_ERASE
+  ers_cancel(drv, sector, cnt);
+#endif
+#if _DISK_PREFETCH
+  pfb_invalidate(drv, sector, cnt);
+#endif
+#if _DISK_COALESCE
+  res = wcb_flush(drv);    /* Keep the write order of the held and the new sectors */
+  if (res != RES_OK) return res;
+#endif
+#if _DISK_ARRAY
+  if (ARR(drv)) return arr_rw(1, vec, nvec, sector);
+#endif
+#if _DISK_ASYNC
+  if (Srv[drv].attached)
+    return srv_call(&req, DISK_OP_WRITEV, drv, (BYTE*)vec, sector, (BYTE)nvec);
+#endif
+  return vec_write(drv, vec, nvec, sector);
+}
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Sectors into a Streaming Channel                                 */
+/*-----------------------------------------------------------------------*/
+/* The sectors go from the card straight to the consumer core, 128 words */
+/* per sector in memory byte order, with a single multiple block read.   */
+/* On an error the rest of the sectors are sent as zero words, so the    */
+/* consumer always gets count * 128 words.                               */
+
+DRESULT disk_read_chan (
+  BYTE drv,      /* Physical drive number */
+  DISKCHAN c,      /* Streaming channel end to the consumer */
+  DWORD sector,    /* Start sector number (LBA) */
+  BYTE count      /* Sector count (1..255) */
+)
+{
+#if _DISK_COALESCE && !_READONLY
+  DRESULT res;
+#endif
+
+
+  if (BAD_DRV(drv) || !count) return RES_PARERR;
+
+#if _DISK_COALESCE && !_READONLY
+  res = wcb_flush_range(drv, sector, count);  /* The card has to see the held data first */
+  if (res != RES_OK) return res;
+#endif
+#if _DISK_ARRAY
+  if (ARR(drv)) return arr_read_chan(c, sector, count);
+#endif
+  return drv_read_chan(drv, c, sector, count);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_ioctl (
+  BYTE drv,    /* Physical drive number */
+  BYTE ctrl,    /* Control code */
+  BYTE buff[]    /* Buffer to send/receive control data */
+)
+{
+#if _DISK_COALESCE && !_READONLY
+  DRESULT res;
+#endif
+
+
+  if (BAD_DRV(drv)) return RES_PARERR;
+
+  if (ctrl == MMC_GET_IOSTAT || ctrl == MMC_CLR_IOSTAT) {  /* Statistics do not access the card */
+#if _DISK_ARRAY
+    if (ARR(drv)) return arr_iostat(ctrl, buff);
+#endif
+    return SD_disk_ioctl(drv, ctrl, buff);
+  }
+#if _DISK_COALESCE && !_READONLY
+  if (ctrl == CTRL_SYNC) {  /* Write back the held sectors before syncing the card */
+    res = wcb_flush(drv);
+    if (res != RES_OK) return res;
+  }
+#endif
+  if (ctrl == CTRL_ERASE_SECTOR)  /* Erase the whole erase blocks of the range (DWORD[2]) */
+    return erase_range(drv, (const DWORD*)buff);
+  return dev_ioctl(drv, ctrl, buff);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Run Idle Time Work                                                    */
+/*-----------------------------------------------------------------------*/
+/* Erases the held ranges (_DISK_ERASE). To be called when the           */
+/* application has nothing else to do. A drive attached to a disk       */
+/* server does it on the server.                                         */
+
+DRESULT disk_idle (
+  BYTE drv    /* Physical drive number */
+)
+{
+#if _DISK_ERASE
+  DRESULT res = RES_OK;
+  DWORD rng[2];
+#endif
+
+
+  if (BAD_DRV(drv)) return RES_PARERR;
+
+#if _DISK_ERASE
+#if _DISK_ASYNC
+  if (SRV(drv)) return RES_OK;
+#endif
+  while (res == RES_OK && ers_take(drv, rng))
+    res = dev_ioctl(drv, CTRL_ERASE_SECTOR, (BYTE*)rng);
+  return res;
+#else
+  return RES_OK;
+#endif
+}
@@ -8,8 +8,67 @@
 
 #define _READONLY       0       /* 1: Remove write functions */
 #define _USE_IOCTL      1       /* 1: Use disk_ioctl fucntion */
+#define _DISK_RETRY     1       /* Number of times a failed read/write is re-issued by the driver */
+#define _DRIVES         1       /* Number of SD host interfaces (entries of SDif[] in the driver) */
+/* Each drive has its own card, ports and state in this layer, so different
+/  drives can be used from different cores at the same time. With _DISK_ASYNC
+/  every drive is driven by a disk_server() core of its own. */
+
+#define _DISK_COALESCE  0       /* 0:Disable or 2..128:Number of contiguous sectors held for a multiple block write */
+/* When _DISK_COALESCE is not 0, single sector writes to contiguous sectors are held
+/  in a buffer of _DISK_COALESCE * 512 bytes per drive and written to the card with
+/  one multiple block write. The held sectors are written on a gap, on a read that
+/  overlaps them, on CTRL_SYNC or when the buffer is full. An error in writing them
+/  back is reported by the disk function that caused the flush. */
+
+#define _DISK_PREFETCH  0       /* 0:Disable or 2..128:Maximum number of sectors read ahead */
+/* When _DISK_PREFETCH is not 0, a sequential or constant stride read stream is
+/  detected on each drive and the sectors ahead of it are fetched with one multiple
+/  block read into a buffer of _DISK_PREFETCH * 512 bytes per drive. Later reads
+/  are served from the buffer. The read-ahead depth adapts between 2 and
+/  _DISK_PREFETCH sectors to the length of the stream. */
+
+#define _DISK_ERASE     4       /* 0:Erase at once or 1..16:Number of erase ranges held for the idle time */
+/* CTRL_ERASE_SECTOR is clipped to whole erase blocks (GET_BLOCK_SIZE) of the card,
+/  ranges smaller than an erase block are not erased. When _DISK_ERASE is not 0, the
+/  ranges are not erased in the ioctl call but held and erased later, by
+/  disk_idle() or by the disk server while its queue is empty. A write to a held
+/  range cancels the erase of that range. The oldest range is erased at once when
+/  the table is full. With 0 f_unlink() and f_truncate() wait for the erase. */
+
+#define _DISK_ARRAY     0       /* 0:Disable or 2.._DRIVES:Number of drives combined into drive 0 */
+#define _DISK_STRIPE    8       /* Stripe size in sectors (striped array) */
+#define _DISK_MIRROR    0       /* 0:Striped (RAID-0) or 1:Mirrored (RAID-1) array */
+/* When _DISK_ARRAY is not 0, the drives 0.._DISK_ARRAY-1 form one virtual drive 0
+/  and are not accessible by themselves. Striped, the sectors are spread over the
+/  cards in runs of _DISK_STRIPE sectors and the capacity is the sum of the cards.
+/  Mirrored, every card holds all sectors, a write goes to all of them and a read
+/  is split between them (a failed read is retried on each card). A transfer is
+/  done as one multiple block transfer per card, in parallel on the cores of the
+/  cards attached to a disk server (_DISK_ASYNC). GET_BLOCK_SIZE reports a whole
+/  erase block on every card, _DISK_STRIPE should not exceed the AU size. The
+/  buffering stages above work on the virtual drive. */
+
+#define _DISK_ASYNC     0       /* 0:Disable or 1:Enable disk server cores */
+#define _DISK_QUEUE     4       /* Depth of the request queue of a disk server (1, 2, 4 or 8) */
+/* When _DISK_ASYNC is 1, a drive can be driven by its own core running
+/  disk_server(). The client core registers its end of the server channel with
+/  disk_attach() before the first access. It can then queue up to _DISK_QUEUE
+/  requests with disk_submit() and work on while the card transfers, and collects
+/  them with disk_wait(). The disk_xxx() functions stay synchronous and go through
+/  the server as well once the drive is attached. With _DISK_PREFETCH the read-ahead
+/  runs on the server, double-buffered. Only one client core can be attached to a
+/  server, and the cores must be on the same tile. */
 
 #include "integer.h"
+#include <xccompat.h>
+
+/* Streaming channel end of disk_read_chan() */
+#ifdef __XC__
+#define DISKCHAN        streaming chanend
+#else
+#define DISKCHAN        unsigned
+#endif
 
 
 /* Status of Disk Functions */
@@ -24,6 +83,37 @@ typedef enum {
         RES_PARERR              /* 4: Invalid Parameter */
 } DRESULT;
 
+/* I/O statistics of a physical drive (MMC_GET_IOSTAT), the sum of the   */
+/* members for an array (_DISK_ARRAY).                                   */
+/* Latencies are measured in reference clock ticks (10ns). Bucket n of a */
+/* histogram counts the operations that took 2^(n-1) to 2^n-1 ticks.    */
+#define DISKSTAT_BUCKETS        32
+
+typedef struct {
+        DWORD   rd_hist[DISKSTAT_BUCKETS];      /* Read latency histogram */
+        DWORD   wr_hist[DISKSTAT_BUCKETS];      /* Write latency histogram */
+        DWORD   busy_hist[DISKSTAT_BUCKETS];    /* Busy-wait latency histogram */
+        DWORD   rd_blocks;                      /* Number of blocks read */
+        DWORD   wr_blocks;                      /* Number of blocks written */
+        QWORD   rd_bytes;                       /* Number of bytes read */
+        QWORD   wr_bytes;                       /* Number of bytes written */
+        DWORD   retries;                        /* Transfers re-issued after an error */
+        DWORD   timeouts;                       /* Ready, data token and busy timeouts */
+        DWORD   wr_busy_max;                    /* Worst-case write busy time */
+} DISKSTAT;
+
+/* Erase geometry and speed class of a card (MMC_GET_AUINFO), read from */
+/* the SD Status (ACMD13) and the CSD at initialization.                */
+typedef struct {
+        DWORD   au_size;                /* Allocation unit size in sectors (GET_BLOCK_SIZE) */
+        WORD    erase_size;             /* Number of AUs erased within erase_timeout (0:not reported) */
+        BYTE    erase_timeout;          /* Erase timeout of erase_size AUs in seconds */
+        BYTE    erase_offset;           /* Erase timeout offset in seconds */
+        BYTE    speed_class;            /* Speed class (0, 2, 4, 6 or 10) */
+        BYTE    uhs_grade;              /* UHS speed grade (0, 1 or 3) */
+        BYTE    discard;                /* 1:Discard is supported */
+} DISKAU;
+
 
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
@@ -36,6 +126,82 @@ DRESULT disk_read (BYTE, BYTE[], DWORD, BYTE);
 DRESULT disk_write (BYTE, const BYTE[], DWORD, BYTE);
 #endif
 DRESULT disk_ioctl (BYTE, BYTE, BYTE[]);
+DRESULT disk_idle (BYTE);
+DRESULT disk_read_chan (BYTE, DISKCHAN, DWORD, BYTE);  /* Read sectors into a streaming channel */
+void disk_chan_signal (chanend);  /* Channel doorbells (diskio_chan.xc) */
+void disk_chan_wait (chanend);
+
+#ifndef __XC__
+/* Segment of a vectored transfer. Consecutive segments map to consecutive sectors. */
+typedef struct {
+        BYTE*   buff;                   /* Segment buffer */
+        UINT    count;                  /* Number of sectors in the segment */
+} DISKVEC;
+
+DRESULT disk_readv (BYTE, const DISKVEC*, UINT, DWORD);
+#if     _READONLY == 0
+DRESULT disk_writev (BYTE, const DISKVEC*, UINT, DWORD);
+#endif
+#endif
+
+/* SD host driver functions (SDCardHostSPI.xc or SDCardHost4Bit.xc), called by diskio.c */
+DSTATUS SD_disk_initialize (BYTE);
+DSTATUS SD_disk_status (BYTE);
+DRESULT SD_disk_read (BYTE, BYTE[], DWORD, BYTE);
+#if     _READONLY == 0
+DRESULT SD_disk_write (BYTE, const BYTE[], DWORD, BYTE);
+#endif
+DRESULT SD_disk_ioctl (BYTE, BYTE, BYTE[]);
+DRESULT SD_disk_read_chan (BYTE, DISKCHAN, DWORD, BYTE);  /* Multiple block read into a streaming channel */
+/* Multiple block transfer session: start, one call per sector, stop */
+DRESULT SD_disk_read_start (BYTE, DWORD);
+DRESULT SD_disk_read_next (BYTE, BYTE[]);
+DRESULT SD_disk_read_stop (BYTE);
+#if     _READONLY == 0
+DRESULT SD_disk_write_start (BYTE, DWORD, DWORD);
+DRESULT SD_disk_write_next (BYTE, const BYTE[]);
+DRESULT SD_disk_write_stop (BYTE);
+#endif
+
+#if _DISK_ASYNC
+/* Asynchronous request interface (diskio.c) */
+void disk_server (chanend, BYTE);
+void disk_attach (BYTE, chanend);
+
+/* Request operations (DISKREQ.op) */
+#define DISK_OP_READ            1       /* disk_read(drv, buff, sector, count) */
+#define DISK_OP_WRITE           2       /* disk_write(drv, buff, sector, count) */
+#define DISK_OP_IOCTL           3       /* disk_ioctl(drv, count, buff) */
+#define DISK_OP_INIT            4       /* disk_initialize(drv) */
+#define DISK_OP_STATUS          5       /* disk_status(drv) */
+#define DISK_OP_READV           6       /* disk_readv(drv, (DISKVEC*)buff, count, sector) */
+#define DISK_OP_WRITEV          7       /* disk_writev(drv, (DISKVEC*)buff, count, sector) */
+#define DISK_OP_READC           8       /* disk_read_chan(drv, chan, sector, count) */
+
+/* Request states (DISKREQ.state) */
+#define DISKREQ_QUEUED          1       /* Queued or in progress on the server */
+#define DISKREQ_DONE            2       /* Completed, res/stat are valid */
+
+#ifndef __XC__
+/* Request descriptor. It must stay valid until the request is completed. */
+typedef struct {
+        BYTE    op;                     /* Operation (DISK_OP_xxx) */
+        BYTE    drv;                    /* Physical drive number */
+        BYTE    count;                  /* Sector count (control code for DISK_OP_IOCTL) */
+        volatile BYTE state;            /* Request state (DISKREQ_xxx) */
+        BYTE    wait;                   /* The client waits for the completion signal */
+        DSTATUS stat;                   /* Disk status (DISK_OP_INIT, DISK_OP_STATUS) */
+        DRESULT res;                    /* Result of the request */
+        DWORD   sector;                 /* Start sector number (LBA) */
+        BYTE*   buff;                   /* Data buffer */
+        DISKCHAN chan;                  /* Streaming channel end (DISK_OP_READC) */
+} DISKREQ;
+
+DRESULT disk_submit (DISKREQ*);
+DRESULT disk_wait (DISKREQ*);
+int disk_done (DISKREQ*);
+#endif
+#endif
 
 /* Disk Status Bits (DSTATUS) */
 
@@ -64,6 +230,9 @@ DRESULT disk_ioctl (BYTE, BYTE, BYTE[]);
 #define MMC_GET_CID                     12      /* Get CID */
 #define MMC_GET_OCR                     13      /* Get OCR */
 #define MMC_GET_SDSTAT          14      /* Get SD status */
+#define MMC_GET_IOSTAT          15      /* Get I/O statistics (DISKSTAT) */
+#define MMC_CLR_IOSTAT          16      /* Reset I/O statistics */
+#define MMC_GET_AUINFO          17      /* Get erase geometry and speed class (DISKAU) */
 
 /* ATA/CF specific ioctl command */
 #define ATA_GET_REV                     20      /* Get F/W revision */
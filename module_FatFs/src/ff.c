@@ -106,6 +106,36 @@
 #error Wrong include file (ff.h).
 #endif
 
+#if !_MULTI_PARTITION && _VOLUMES > _DRIVES
+#error _VOLUMES must not exceed the number of drives (_DRIVES).
+#endif
+
+#if !_FS_FAT12 && !_FS_FAT16 && !_FS_FAT32 && !_FS_EXFAT
+#error No FAT type is enabled.
+#endif
+
+#if _USE_FRAGSTAT && _FS_MINIMIZE > 1
+#error _USE_FRAGSTAT needs f_readdir (_FS_MINIMIZE <= 1).
+#endif
+
+#if _FS_EXFAT
+#if !_USE_LFN
+#error _FS_EXFAT needs the LFN feature (_USE_LFN >= 1).
+#endif
+#if _FS_RPATH || _USE_FASTSEEK
+#error _FS_EXFAT cannot be used with _FS_RPATH or _USE_FASTSEEK.
+#endif
+#endif
+
+
+/* FAT types built in. The type of a volume is a constant when only one is. */
+#define FAT_ENABLED(t)  (((t) == FS_FAT12 && _FS_FAT12) || ((t) == FS_FAT16 && _FS_FAT16) || ((t) == FS_FAT32 && _FS_FAT32))
+#if _FS_FAT12 + _FS_FAT16 + _FS_FAT32 + _FS_EXFAT == 1
+#define FAT_TYPE(fs)  (_FS_FAT12 ? FS_FAT12 : _FS_FAT16 ? FS_FAT16 : _FS_FAT32 ? FS_FAT32 : FS_EXFAT)
+#else
+#define FAT_TYPE(fs)  ((fs)->fs_type)
+#endif
+
 
 /* Definitions on sector size */
 #if _MAX_SS != 512 && _MAX_SS != 1024 && _MAX_SS != 2048 && _MAX_SS != 4096
@@ -151,6 +181,20 @@ typedef struct {
 #define LD_CLUST(dir)  (((DWORD)LD_WORD(dir+DIR_FstClusHI)<<16) | LD_WORD(dir+DIR_FstClusLO))
 #define ST_CLUST(dir,cl) {ST_WORD(dir+DIR_FstClusLO, cl); ST_WORD(dir+DIR_FstClusHI, (DWORD)cl>>16);}
 
+/* Attribute, start cluster and size of the object found in a directory object */
+#if _FS_EXFAT
+#define OBJ_ATTR(dj)  ((dj)->fs->fs_type == FS_EXFAT ? (dj)->xent[XDIR_Attr] : (dj)->dir[DIR_Attr])
+#define OBJ_CLUST(dj)  ((dj)->fs->fs_type == FS_EXFAT ? LD_DWORD((dj)->xent+XDIR_FstClus) : LD_CLUST((dj)->dir))
+#define OBJ_SIZE(dj)  ((dj)->fs->fs_type == FS_EXFAT ? LD_QWORD((dj)->xent+XDIR_FileSize) : LD_DWORD((dj)->dir+DIR_FileSize))
+#define SZ_CLUST(fs)  ((DWORD)(fs)->csize * SS(fs))  /* Cluster size [byte] */
+#define next_clust(fp, clst)  ((fp)->stat == 2 ? (clst) + 1 : get_fat((fp)->fs, clst))  /* Contiguous files need no FAT */
+#else
+#define OBJ_ATTR(dj)  ((dj)->dir[DIR_Attr])
+#define OBJ_CLUST(dj)  LD_CLUST((dj)->dir)
+#define OBJ_SIZE(dj)  LD_DWORD((dj)->dir+DIR_FileSize)
+#define next_clust(fp, clst)  get_fat((fp)->fs, clst)
+#endif
+
 
 /* DBCS code ranges and SBCS extend char conversion table */
 
@@ -454,6 +498,36 @@ typedef struct {
 #define  DDE          0xE5  /* Deleted directory enrty mark in DIR_Name[0] */
 #define  NDDE        0x05  /* Replacement of a character collides with DDE */
 
+/* exFAT boot sector and directory entries. The stream extension entry
+   follows the file entry, its fields are given as offsets in DIR.xent[]. */
+#define BPB_FatOfsEx    80  /* exFAT: FAT offset [sector] (4) */
+#define BPB_FatSzEx      84  /* exFAT: FAT size [sector] (4) */
+#define BPB_DataOfsEx    88  /* exFAT: Cluster heap offset [sector] (4) */
+#define BPB_NumClusEx    92  /* exFAT: Number of clusters (4) */
+#define BPB_RootClusEx    96  /* exFAT: Root dir first cluster (4) */
+#define BPB_FSVerEx      104  /* exFAT: File system revision (2) */
+#define BPB_TotSecEx    72  /* exFAT: Volume size [sector] (8) */
+#define BPB_BytsPerSecEx  108  /* exFAT: log2 of sector size [byte] (1) */
+#define BPB_SecPerClusEx  109  /* exFAT: log2 of cluster size [sector] (1) */
+#define BPB_NumFATsEx    110  /* exFAT: Number of FAT copies (1) */
+#define  XDIR_Type      0  /* exFAT: Entry type (1) */
+#define  XDIR_NumSec      1  /* exFAT: Number of secondary entries (1) */
+#define  XDIR_SetSum      2  /* exFAT: Sum of the entry set (2) */
+#define  XDIR_Attr      4  /* exFAT: Attribute (2) */
+#define  XDIR_CrtTime      8  /* exFAT: Created time and date (4) */
+#define  XDIR_ModTime      12  /* exFAT: Modified time and date (4) */
+#define  XDIR_Name      2  /* exFAT: 15 name characters in a name entry (30) */
+#define  XDIR_GenFlags    33  /* exFAT: Allocation flags, bit1:Contiguous (1) */
+#define  XDIR_NumName    35  /* exFAT: Name length (1) */
+#define  XDIR_NameHash    36  /* exFAT: Hash of the up-cased name (2) */
+#define  XDIR_ValidFileSize  40  /* exFAT: Valid data length (8) */
+#define  XDIR_FstClus    52  /* exFAT: First cluster (4) */
+#define  XDIR_FileSize    56  /* exFAT: Data length (8) */
+#define  ET_BITMAP      0x81  /* exFAT: Allocation bitmap entry */
+#define  ET_FILE        0x85  /* exFAT: File entry */
+#define  ET_STREAM      0xC0  /* exFAT: Stream extension entry */
+#define  ET_NAME        0xC1  /* exFAT: File name entry */
+
 
 /*------------------------------------------------------------*/
 /* Module private work area                                   */
@@ -481,6 +555,17 @@ BYTE CurrVol;      /* Current drive */
 #if _FS_SHARE
 static
 FILESEM  Files[_FS_SHARE];  /* File lock semaphores */
+#if _FS_REENTRANT && _VOLUMES > 1
+static
+_SYNC_t FilesSobj;    /* Sync object of the file lock table shared by the volumes */
+static
+BYTE FilesSobjOk;    /* FilesSobj has been created */
+#define LOCK_FILES()  ff_req_grant(FilesSobj)
+#define UNLOCK_FILES()  ff_rel_grant(FilesSobj)
+#else
+#define LOCK_FILES()
+#define UNLOCK_FILES()
+#endif
 #endif
 
 #if _USE_LFN == 0      /* No LFN feature */
@@ -524,19 +609,64 @@ static WCHAR LfnBuf[_MAX_LFN+1];
 /* String functions                                                      */
 /*-----------------------------------------------------------------------*/
 
+/* The memory functions move the data a word or a double-word at a time  */
+/* where the buffers allow it: between equally aligned buffers with      */
+/* LDW/STW, or LDD/STD on the cores that have them, and between          */
+/* differently aligned buffers by merging aligned source words with      */
+/* shifts, which needs a little-endian byte order as on xCORE. The words */
+/* are accessed through may_alias types, as the buffers hold any type,   */
+/* and no word is read beyond the cnt bytes of the source.               */
+
+#if defined(__GNUC__) || defined(__clang__)
+typedef UINT __attribute__((__may_alias__)) AWORD;
+typedef QWORD __attribute__((__may_alias__)) AQWORD;
+#else
+typedef UINT AWORD;
+typedef QWORD AQWORD;
+#endif
+
 /* Copy memory to memory */
 static
 void mem_cpy (void* dst, const void* src, UINT cnt) {
   BYTE *d = (BYTE*)dst;
   const BYTE *s = (const BYTE*)src;
+  AWORD *dw;
+  const AWORD *sw;
+  UINT sh, i, w0, w1;
 
-#if _WORD_ACCESS == 1
-  while (cnt >= sizeof(int)) {
-    *(int*)d = *(int*)s;
-    d += sizeof(int); s += sizeof(int);
-    cnt -= sizeof(int);
+  if (cnt >= 8) {
+    while ((UINT)d & 3) {      /* Bytes up to a word boundary of the destination */
+      *d++ = *s++; cnt--;
+    }
+    dw = (AWORD*)d;
+    sh = (UINT)s & 3;
+    if (!sh) {            /* Equally aligned, copy the words */
+      sw = (const AWORD*)s;
+      if (!(((UINT)dw ^ (UINT)sw) & 4)) {  /* Equally aligned double-words too */
+        if ((UINT)dw & 4) {
+          *dw++ = *sw++; cnt -= 4;
+        }
+        for ( ; cnt >= 8; cnt -= 8) {
+          *(AQWORD*)dw = *(const AQWORD*)sw;
+          dw += 2; sw += 2;
+        }
+      }
+      for ( ; cnt >= 4; cnt -= 4)
+        *dw++ = *sw++;
+    } else {            /* Merge two aligned source words into each destination word */
+      sw = (const AWORD*)(s - sh) + 1;
+      w0 = 0;
+      for (i = sh; i < 4; i++)    /* The bytes of the first source word from s on */
+        w0 |= (UINT)s[i - sh] << (i * 8);
+      for ( ; cnt >= 8 - sh; cnt -= 4) {  /* While the next source word is all within cnt */
+        w1 = *sw++;
+        *dw++ = (w0 >> (sh * 8)) | (w1 << (32 - sh * 8));
+        w0 = w1;
+      }
+    }
+    s += (BYTE*)dw - d;
+    d = (BYTE*)dw;
   }
-#endif
   while (cnt--)
     *d++ = *s++;
 }
@@ -545,7 +675,29 @@ void mem_cpy (void* dst, const void* src, UINT cnt) {
 static
 void mem_set (void* dst, int val, UINT cnt) {
   BYTE *d = (BYTE*)dst;
+  AWORD *dw;
+  UINT w;
+  QWORD q;
 
+  if (cnt >= 8) {
+    while ((UINT)d & 3) {      /* Bytes up to a word boundary */
+      *d++ = (BYTE)val; cnt--;
+    }
+    dw = (AWORD*)d;
+    w = (UINT)(BYTE)val * 0x01010101;
+    if ((UINT)dw & 4) {        /* A word up to a double-word boundary */
+      *dw++ = w; cnt -= 4;
+    }
+    q = (QWORD)w << 32 | w;
+    for ( ; cnt >= 8; cnt -= 8) {
+      *(AQWORD*)dw = q;
+      dw += 2;
+    }
+    if (cnt >= 4) {
+      *dw++ = w; cnt -= 4;
+    }
+    d = (BYTE*)dw;
+  }
   while (cnt--)
     *d++ = (BYTE)val;
 }
@@ -556,7 +708,15 @@ int mem_cmp (const void* dst, const void* src, UINT cnt) {
   const BYTE *d = (const BYTE *)dst, *s = (const BYTE *)src;
   int r = 0;
 
-  while (cnt-- && (r = *d++ - *s++) == 0) ;
+  if (cnt >= 8 && !(((UINT)d ^ (UINT)s) & 3)) {  /* Equally aligned, skip the equal words */
+    for ( ; (UINT)d & 3; cnt--) {
+      if ((r = *d++ - *s++) != 0) return r;
+    }
+    for ( ; cnt >= 4 && *(const AWORD*)d == *(const AWORD*)s; cnt -= 4) {
+      d += 4; s += 4;
+    }
+  }
+  while (cnt-- && (r = *d++ - *s++) == 0) ;  /* The first different byte decides */
   return r;
 }
 
@@ -612,7 +772,10 @@ FRESULT chk_lock (  /* Check if the file can be accessed */
 )
 {
   UINT i, be;
+  FRESULT res;
+
 
+  LOCK_FILES();
   /* Search file semaphore table */
   for (i = be = 0; i < _FS_SHARE; i++) {
     if (Files[i].fs) {  /* Existing entry */
@@ -624,10 +787,12 @@ FRESULT chk_lock (  /* Check if the file can be accessed */
     }
   }
   if (i == _FS_SHARE)  /* The file is not opened */
-    return (be || acc == 2) ? FR_OK : FR_TOO_MANY_OPEN_FILES;  /* Is there a blank entry for new file? */
+    res = (be || acc == 2) ? FR_OK : FR_TOO_MANY_OPEN_FILES;  /* Is there a blank entry for new file? */
+  else  /* The file has been opened. Reject any open against writing file and all write mode open */
+    res = (acc || Files[i].ctr == 0x100) ? FR_LOCKED : FR_OK;
+  UNLOCK_FILES();
 
-  /* The file has been opened. Reject any open against writing file and all write mode open */
-  return (acc || Files[i].ctr == 0x100) ? FR_LOCKED : FR_OK;
+  return res;
 }
 
 
@@ -636,7 +801,9 @@ int enq_lock (void)  /* Check if an entry is available for a new file */
 {
   UINT i;
 
+  LOCK_FILES();
   for (i = 0; i < _FS_SHARE && Files[i].fs; i++) ;
+  UNLOCK_FILES();
   return (i == _FS_SHARE) ? 0 : 1;
 }
 
@@ -650,6 +817,7 @@ UINT inc_lock (  /* Increment file open counter and returns its index (0:int err
   UINT i;
 
 
+  LOCK_FILES();
   for (i = 0; i < _FS_SHARE; i++) {  /* Find the file */
     if (Files[i].fs == dj->fs &&
       Files[i].clu == dj->sclust &&
@@ -658,16 +826,23 @@ UINT inc_lock (  /* Increment file open counter and returns its index (0:int err
 
   if (i == _FS_SHARE) {        /* Not opened. Register it as new. */
     for (i = 0; i < _FS_SHARE && Files[i].fs; i++) ;
-    if (i == _FS_SHARE) return 0;  /* No space to register (int err) */
+    if (i == _FS_SHARE) {      /* No space to register (int err) */
+      UNLOCK_FILES();
+      return 0;
+    }
     Files[i].fs = dj->fs;
     Files[i].clu = dj->sclust;
     Files[i].idx = dj->index;
     Files[i].ctr = 0;
   }
 
-  if (acc && Files[i].ctr) return 0;  /* Access violation (int err) */
+  if (acc && Files[i].ctr) {      /* Access violation (int err) */
+    UNLOCK_FILES();
+    return 0;
+  }
 
   Files[i].ctr = acc ? 0x100 : Files[i].ctr + 1;  /* Set semaphore value */
+  UNLOCK_FILES();
 
   return i + 1;
 }
@@ -683,11 +858,13 @@ FRESULT dec_lock (  /* Decrement file open counter */
 
 
   if (--i < _FS_SHARE) {
+    LOCK_FILES();
     n = Files[i].ctr;
     if (n == 0x100) n = 0;
     if (n) n--;
     Files[i].ctr = n;
     if (!n) Files[i].fs = 0;
+    UNLOCK_FILES();
     res = FR_OK;
   } else {
     res = FR_INT_ERR;
@@ -703,9 +880,11 @@ void clear_lock (  /* Clear lock entries of the volume */
 {
   UINT i;
 
+  LOCK_FILES();
   for (i = 0; i < _FS_SHARE; i++) {
     if (Files[i].fs == fs) Files[i].fs = 0;
   }
+  UNLOCK_FILES();
 }
 #endif
 
@@ -814,38 +993,81 @@ DWORD clust2sect (  /* !=0: Sector number, 0: Failed - invalid cluster# */
 /*-----------------------------------------------------------------------*/
 /* FAT access - Read value of a FAT entry                                */
 /*-----------------------------------------------------------------------*/
+/* The accessors of each FAT type take a cluster# the caller has checked */
+/* already. get_fat() checks it and picks the accessor for the volume.   */
 
-
-DWORD get_fat (  /* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster status */
+#if _FS_FAT12
+static
+DWORD get_fat12 (  /* 0xFFFFFFFF:Disk error, Else:Cluster status */
   FATFS *fs,  /* File system object */
-  DWORD clst  /* Cluster# to get the link information */
+  DWORD clst  /* Cluster# in range of 2 to fs->n_fatent - 1 */
 )
 {
   UINT wc, bc;
-  BYTE *p;
 
 
+  bc = (UINT)clst; bc += bc / 2;    /* An entry can straddle two sectors */
+  if (move_window(fs, fs->fatbase + (bc / SS(fs)))) return 0xFFFFFFFF;
+  wc = fs->win[bc % SS(fs)]; bc++;
+  if (move_window(fs, fs->fatbase + (bc / SS(fs)))) return 0xFFFFFFFF;
+  wc |= fs->win[bc % SS(fs)] << 8;
+  return (clst & 1) ? (wc >> 4) : (wc & 0xFFF);
+}
+#endif
+
+
+#if _FS_FAT16
+static
+DWORD get_fat16 (  /* 0xFFFFFFFF:Disk error, Else:Cluster status */
+  FATFS *fs,  /* File system object */
+  DWORD clst  /* Cluster# in range of 2 to fs->n_fatent - 1 */
+)
+{
+  if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)))) return 0xFFFFFFFF;
+  return LD_WORD(&fs->win[clst * 2 % SS(fs)]);
+}
+#endif
+
+
+#if _FS_FAT32 || _FS_EXFAT
+static
+DWORD get_fat32 (  /* 0xFFFFFFFF:Disk error, Else:Cluster status */
+  FATFS *fs,  /* File system object */
+  DWORD clst,  /* Cluster# in range of 2 to fs->n_fatent - 1 */
+  DWORD mask  /* Bits of the entry (0x0FFFFFFF:FAT32, 0x7FFFFFFF:exFAT) */
+)
+{
+  if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)))) return 0xFFFFFFFF;
+  return LD_DWORD(&fs->win[clst * 4 % SS(fs)]) & mask;
+}
+#endif
+
+
+DWORD get_fat (  /* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster status */
+  FATFS *fs,  /* File system object */
+  DWORD clst  /* Cluster# to get the link information */
+)
+{
   if (clst < 2 || clst >= fs->n_fatent)  /* Chack range */
     return 1;
 
-  switch (fs->fs_type) {
+  switch (FAT_TYPE(fs)) {
+#if _FS_FAT12
   case FS_FAT12 :
-    bc = (UINT)clst; bc += bc / 2;
-    if (move_window(fs, fs->fatbase + (bc / SS(fs)))) break;
-    wc = fs->win[bc % SS(fs)]; bc++;
-    if (move_window(fs, fs->fatbase + (bc / SS(fs)))) break;
-    wc |= fs->win[bc % SS(fs)] << 8;
-    return (clst & 1) ? (wc >> 4) : (wc & 0xFFF);
-
+    return get_fat12(fs, clst);
+#endif
+#if _FS_FAT16
   case FS_FAT16 :
-    if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)))) break;
-    p = &fs->win[clst * 2 % SS(fs)];
-    return LD_WORD(p);
-
+    return get_fat16(fs, clst);
+#endif
+#if _FS_FAT32
   case FS_FAT32 :
-    if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)))) break;
-    p = &fs->win[clst * 4 % SS(fs)];
-    return LD_DWORD(p) & 0x0FFFFFFF;
+    return get_fat32(fs, clst, 0x0FFFFFFF);
+#endif
+#if _FS_EXFAT
+  case FS_EXFAT :
+    return get_fat32(fs, clst, 0x7FFFFFFF);
+#endif
   }
 
   return 0xFFFFFFFF;  /* An error occurred at the disk I/O layer */
@@ -854,14 +1076,79 @@ DWORD get_fat (  /* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster status
 
 
 
+/*-----------------------------------------------------------------------*/
+/* FAT access - Follow a cluster chain                                   */
+/*-----------------------------------------------------------------------*/
+/* The FAT type is picked once for the walk. FAT16/32 chains are         */
+/* followed in a loop on the win[] that calls move_window() only when a  */
+/* link leads to another FAT sector.                                     */
+
+static
+DWORD walk_fat (  /* 0xFFFFFFFF:Disk error, 1:Chain ended or broken, Else:Cluster reached */
+  FATFS *fs,  /* File system object */
+  DWORD clst,  /* Cluster# to start from */
+  DWORD n    /* Number of links to follow */
+)
+{
+#if _FS_FAT16 || _FS_FAT32 || _FS_EXFAT
+  DWORD sect;
+#endif
+#if _FS_FAT32 || _FS_EXFAT
+  DWORD mask;
+#endif
+
+
+  switch (FAT_TYPE(fs)) {
+#if _FS_FAT16
+  case FS_FAT16 :
+    for ( ; n; n--) {
+      if (clst < 2 || clst >= fs->n_fatent) return 1;
+      sect = fs->fatbase + clst / (SS(fs) / 2);
+      if (sect != fs->winsect && move_window(fs, sect)) return 0xFFFFFFFF;
+      clst = LD_WORD(&fs->win[clst * 2 % SS(fs)]);
+    }
+    break;
+#endif
+#if _FS_FAT32 || _FS_EXFAT
+#if _FS_FAT32
+  case FS_FAT32 :
+#endif
+#if _FS_EXFAT
+  case FS_EXFAT :
+#endif
+    mask = (FAT_TYPE(fs) == FS_EXFAT) ? 0x7FFFFFFF : 0x0FFFFFFF;
+    for ( ; n; n--) {
+      if (clst < 2 || clst >= fs->n_fatent) return 1;
+      sect = fs->fatbase + clst / (SS(fs) / 4);
+      if (sect != fs->winsect && move_window(fs, sect)) return 0xFFFFFFFF;
+      clst = LD_DWORD(&fs->win[clst * 4 % SS(fs)]) & mask;
+    }
+    break;
+#endif
+  default :      /* FAT12 goes entry by entry */
+    for ( ; n; n--) {
+      clst = get_fat(fs, clst);
+      if (clst == 0xFFFFFFFF) return clst;
+    }
+  }
+  if (clst < 2 || clst >= fs->n_fatent) return 1;
+
+  return clst;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT access - Change value of a FAT entry                              */
 /*-----------------------------------------------------------------------*/
 #if !_FS_READONLY
 
-FRESULT put_fat (
+#if _FS_FAT12
+static
+FRESULT put_fat12 (
   FATFS *fs,  /* File system object */
-  DWORD clst,  /* Cluster# to be changed in range of 2 to fs->n_fatent - 1 */
+  DWORD clst,  /* Cluster# in range of 2 to fs->n_fatent - 1 */
   DWORD val  /* New value to mark the cluster */
 )
 {
@@ -870,40 +1157,103 @@ FRESULT put_fat (
   FRESULT res;
 
 
+  bc = clst; bc += bc / 2;
+  res = move_window(fs, fs->fatbase + (bc / SS(fs)));
+  if (res != FR_OK) return res;
+  p = &fs->win[bc % SS(fs)];
+  *p = (clst & 1) ? ((*p & 0x0F) | ((BYTE)val << 4)) : (BYTE)val;
+  bc++;
+  fs->wflag = 1;
+  res = move_window(fs, fs->fatbase + (bc / SS(fs)));
+  if (res != FR_OK) return res;
+  p = &fs->win[bc % SS(fs)];
+  *p = (clst & 1) ? (BYTE)(val >> 4) : ((*p & 0xF0) | ((BYTE)(val >> 8) & 0x0F));
+  return FR_OK;
+}
+#endif
+
+
+#if _FS_FAT16
+static
+FRESULT put_fat16 (
+  FATFS *fs,  /* File system object */
+  DWORD clst,  /* Cluster# in range of 2 to fs->n_fatent - 1 */
+  DWORD val  /* New value to mark the cluster */
+)
+{
+  FRESULT res;
+
+
+  res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)));
+  if (res == FR_OK) {
+    ST_WORD(&fs->win[clst * 2 % SS(fs)], (WORD)val);
+  }
+  return res;
+}
+#endif
+
+
+#if _FS_FAT32 || _FS_EXFAT
+static
+FRESULT put_fat32 (
+  FATFS *fs,  /* File system object */
+  DWORD clst,  /* Cluster# in range of 2 to fs->n_fatent - 1 */
+  DWORD val  /* New value to mark the cluster */
+)
+{
+  BYTE *p;
+  FRESULT res;
+
+
+  res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)));
+  if (res != FR_OK) return res;
+  p = &fs->win[clst * 4 % SS(fs)];
+#if _FS_EXFAT
+  if (FAT_TYPE(fs) == FS_EXFAT) {
+    if (val == 0x0FFFFFFF) val = 0xFFFFFFFF;  /* End of chain mark */
+  } else
+#endif
+  val |= LD_DWORD(p) & 0xF0000000;    /* FAT32 keeps the upper 4 bits */
+  ST_DWORD(p, val);
+  return FR_OK;
+}
+#endif
+
+
+FRESULT put_fat (
+  FATFS *fs,  /* File system object */
+  DWORD clst,  /* Cluster# to be changed in range of 2 to fs->n_fatent - 1 */
+  DWORD val  /* New value to mark the cluster */
+)
+{
+  FRESULT res;
+
+
   if (clst < 2 || clst >= fs->n_fatent) {  /* Check range */
     res = FR_INT_ERR;
 
   } else {
-    switch (fs->fs_type) {
+    switch (FAT_TYPE(fs)) {
+#if _FS_FAT12
     case FS_FAT12 :
-      bc = clst; bc += bc / 2;
-      res = move_window(fs, fs->fatbase + (bc / SS(fs)));
-      if (res != FR_OK) break;
-      p = &fs->win[bc % SS(fs)];
-      *p = (clst & 1) ? ((*p & 0x0F) | ((BYTE)val << 4)) : (BYTE)val;
-      bc++;
-      fs->wflag = 1;
-      res = move_window(fs, fs->fatbase + (bc / SS(fs)));
-      if (res != FR_OK) break;
-      p = &fs->win[bc % SS(fs)];
-      *p = (clst & 1) ? (BYTE)(val >> 4) : ((*p & 0xF0) | ((BYTE)(val >> 8) & 0x0F));
+      res = put_fat12(fs, clst, val);
       break;
-
+#endif
+#if _FS_FAT16
     case FS_FAT16 :
-      res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)));
-      if (res != FR_OK) break;
-      p = &fs->win[clst * 2 % SS(fs)];
-      ST_WORD(p, (WORD)val);
+      res = put_fat16(fs, clst, val);
       break;
-
+#endif
+#if _FS_FAT32 || _FS_EXFAT
+#if _FS_FAT32
     case FS_FAT32 :
-      res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)));
-      if (res != FR_OK) break;
-      p = &fs->win[clst * 4 % SS(fs)];
-      val |= LD_DWORD(p) & 0xF0000000;
-      ST_DWORD(p, val);
+#endif
+#if _FS_EXFAT
+    case FS_EXFAT :
+#endif
+      res = put_fat32(fs, clst, val);
       break;
-
+#endif
     default :
       res = FR_INT_ERR;
     }
@@ -917,6 +1267,109 @@ FRESULT put_fat (
 
 
 
+#if _FS_EXFAT && !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Find a free cluster in the allocation bitmap         */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD find_bitmap (  /* 0:No free cluster, 0xFFFFFFFF:Disk error, >=2:Free cluster# */
+  FATFS *fs,  /* File system object */
+  DWORD clst  /* Cluster# to start the search from */
+)
+{
+  DWORD val, nv, scl, n;
+  BYTE b;
+
+
+  if (clst < 2 || clst >= fs->n_fatent) clst = 2;
+  scl = val = clst - 2;    /* Bit index of the start cluster */
+  n = fs->n_fatent - 2;    /* Number of bits in the bitmap */
+  for (;;) {
+    if (move_window(fs, fs->bitbase + val / 8 / SS(fs))) return 0xFFFFFFFF;
+    b = fs->win[val / 8 % SS(fs)];
+    if (b == 0xFF && !(val % 8)) {  /* Skip a fully allocated byte */
+      nv = val + 8;
+    } else {
+      if (!(b & (1 << (val % 8)))) return val + 2;  /* Found a free cluster */
+      nv = val + 1;
+    }
+    if (val < scl && nv >= scl) return 0;  /* All clusters scanned */
+    if (nv >= n) {            /* Wrap around */
+      nv = 0;
+      if (!scl) return 0;
+    }
+    val = nv;
+  }
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Set or clear bits of the allocation bitmap           */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT change_bitmap (
+  FATFS *fs,  /* File system object */
+  DWORD clst,  /* First cluster# to change */
+  DWORD ncl,  /* Number of clusters to change */
+  int bv    /* Bit value (0:Free, 1:In use) */
+)
+{
+  DWORD val;
+  BYTE *p, bm;
+
+
+  if (clst < 2 || clst >= fs->n_fatent || ncl > fs->n_fatent - clst)  /* Check range */
+    return FR_INT_ERR;
+
+  val = clst - 2;
+  while (ncl--) {
+    if (move_window(fs, fs->bitbase + val / 8 / SS(fs))) return FR_DISK_ERR;
+    p = &fs->win[val / 8 % SS(fs)]; bm = 1 << (val % 8);
+    if (bv) *p |= bm; else *p &= ~bm;
+    fs->wflag = 1;
+    val++;
+  }
+
+  return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Allocate a free cluster                              */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD alloc_xclust (  /* 0:No free cluster, 0xFFFFFFFF:Disk error, >=2:Allocated cluster# */
+  FATFS *fs,  /* File system object */
+  DWORD clst  /* Cluster# wanted, the search starts there */
+)
+{
+  DWORD ncl;
+
+
+  ncl = find_bitmap(fs, clst);
+  if (ncl >= 2 && ncl != 0xFFFFFFFF) {
+    if (change_bitmap(fs, ncl, 1, 1) != FR_OK) return 0xFFFFFFFF;
+    fs->last_clust = ncl;
+    if (fs->free_clust != 0xFFFFFFFF) {  /* Update free cluster count */
+      fs->free_clust--;
+      fs->fsi_flag = 1;
+    }
+  }
+
+  return ncl;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Remove a cluster chain                                 */
 /*-----------------------------------------------------------------------*/
@@ -943,19 +1396,27 @@ FRESULT remove_chain (
       if (nxt == 0) break;        /* Empty cluster? */
       if (nxt == 1) { res = FR_INT_ERR; break; }  /* Internal error? */
       if (nxt == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }  /* Disk error? */
+#if _FS_EXFAT
+      if (fs->fs_type == FS_EXFAT)
+        res = change_bitmap(fs, clst, 1, 0);  /* Mark the cluster "free" in the bitmap */
+      else
+#endif
       res = put_fat(fs, clst, 0);      /* Mark the cluster "empty" */
       if (res != FR_OK) break;
       if (fs->free_clust != 0xFFFFFFFF) {  /* Update FSInfo */
         fs->free_clust++;
         fs->fsi_flag = 1;
       }
+#if _FS_AUALLOC
+      fs->au_next = 0;        /* Erase blocks may be free again */
+#endif
 #if _USE_ERASE
       if (ecl + 1 == nxt) {  /* Next cluster is contiguous */
         ecl = nxt;
       } else {        /* End of contiguous clusters */
         resion[0] = clust2sect(fs, scl);          /* Start sector */
         resion[1] = clust2sect(fs, ecl) + fs->csize - 1;  /* End sector */
-        disk_ioctl(fs->drv, CTRL_ERASE_SECTOR, resion);    /* Erase the block */
+        disk_ioctl(fs->drv, CTRL_ERASE_SECTOR, (BYTE*)resion);    /* Erase the block */
         scl = ecl = nxt;
       }
 #endif
@@ -970,32 +1431,76 @@ FRESULT remove_chain (
 
 
 
+#if !_FS_READONLY
+#if _FS_EXFAT
 /*-----------------------------------------------------------------------*/
-/* FAT handling - Stretch or Create a cluster chain                      */
+/* exFAT handling - Remove a contiguous object or a cluster chain        */
 /*-----------------------------------------------------------------------*/
-#if !_FS_READONLY
+
 static
-DWORD create_chain (  /* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+FRESULT remove_obj (
   FATFS *fs,      /* File system object */
-  DWORD clst      /* Cluster# to stretch. 0 means create a new chain. */
+  DWORD clst,      /* First cluster# of the object */
+  DWORD ncl      /* Number of clusters of a contiguous object (0:FAT chain) */
 )
 {
-  DWORD cs, ncl, scl;
   FRESULT res;
+#if _USE_ERASE
+  DWORD resion[2];
+#endif
 
 
-  if (clst == 0) {    /* Create a new chain */
-    scl = fs->last_clust;      /* Get suggested start point */
-    if (!scl || scl >= fs->n_fatent) scl = 1;
-  }
-  else {          /* Stretch the current chain */
-    cs = get_fat(fs, clst);      /* Check the cluster status */
-    if (cs < 2) return 1;      /* It is an invalid cluster */
-    if (cs < fs->n_fatent) return cs;  /* It is already followed by next cluster */
-    scl = clst;
-  }
+  if (!ncl) return remove_chain(fs, clst);
 
-  ncl = scl;        /* Start cluster */
+  res = change_bitmap(fs, clst, ncl, 0);  /* Free the clusters at a time */
+  if (res == FR_OK) {
+    if (fs->free_clust != 0xFFFFFFFF) {
+      fs->free_clust += ncl;
+      fs->fsi_flag = 1;
+    }
+#if _USE_ERASE
+    resion[0] = clust2sect(fs, clst);          /* Start sector */
+    resion[1] = clust2sect(fs, clst + ncl - 1) + fs->csize - 1;  /* End sector */
+    disk_ioctl(fs->drv, CTRL_ERASE_SECTOR, (BYTE*)resion);    /* Erase the block */
+#endif
+  }
+
+  return res;
+}
+#else
+#define remove_obj(fs, clst, ncl)  remove_chain(fs, clst)
+#endif
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Stretch or Create a cluster chain                      */
+/*-----------------------------------------------------------------------*/
+#if !_FS_READONLY
+static
+DWORD create_chain (  /* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+  FATFS *fs,      /* File system object */
+  DWORD clst      /* Cluster# to stretch. 0 means create a new chain. */
+)
+{
+  DWORD cs, ncl, scl;
+  FRESULT res;
+
+
+  if (clst == 0) {    /* Create a new chain */
+    scl = fs->last_clust;      /* Get suggested start point */
+    if (!scl || scl >= fs->n_fatent) scl = 1;
+  }
+  else {          /* Stretch the current chain */
+    cs = get_fat(fs, clst);      /* Check the cluster status */
+    if (cs < 2) return 1;      /* It is an invalid cluster */
+    if (cs < fs->n_fatent) return cs;  /* It is already followed by next cluster */
+    scl = clst;
+  }
+
+  ncl = scl;        /* Start cluster */
   for (;;) {
     ncl++;              /* Next cluster */
     if (ncl >= fs->n_fatent) {    /* Wrap around */
@@ -1025,6 +1530,169 @@ DWORD create_chain (  /* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk er
 
   return ncl;    /* Return new cluster number or error code */
 }
+
+
+
+
+#if _FS_AUALLOC
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Check if an erase block is free                        */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD au_free (    /* 1:Free, 0:Used, 0xFFFFFFFF:Disk error */
+  FATFS *fs,    /* File system object */
+  DWORD clst    /* First cluster# of the erase block */
+)
+{
+  DWORD n, cs;
+
+
+  for (n = 0; n < fs->au_clust && clst + n < fs->n_fatent; n++) {
+    cs = get_fat(fs, clst + n);
+    if (cs == 0xFFFFFFFF) return cs;
+    if (cs) return 0;
+  }
+  return 1;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Stretch or Create a file chain in free erase blocks    */
+/*-----------------------------------------------------------------------*/
+/* The file grows from its last cluster. A new chain, and a chain that   */
+/* runs into a used erase block, continues at the first cluster of a     */
+/* free erase block. Each file being written owns its own blocks.        */
+
+static
+DWORD create_chain_au (  /* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+  FATFS *fs,      /* File system object */
+  DWORD clst      /* Cluster# to stretch. 0 means create a new chain. */
+)
+{
+  DWORD cs, ncl, k, n_au, i;
+  FRESULT res;
+
+
+  if (fs->au_clust < 2) return create_chain(fs, clst);  /* Allocation not aligned */
+
+  if (clst != 0) {    /* Stretch the current chain */
+    cs = get_fat(fs, clst);      /* Check the cluster status */
+    if (cs < 2) return 1;      /* It is an invalid cluster */
+    if (cs == 0xFFFFFFFF) return cs;  /* Disk error */
+    if (cs < fs->n_fatent) return cs;  /* It is already followed by next cluster */
+    ncl = clst + 1;          /* Continue contiguously if possible */
+    if (ncl < fs->n_fatent) {
+      cs = get_fat(fs, ncl);
+      if (cs == 1 || cs == 0xFFFFFFFF) return cs;
+      if (cs == 0) {
+        if ((ncl - 2 + fs->au_ofs) % fs->au_clust) goto found;  /* In the same erase block */
+        cs = au_free(fs, ncl);    /* Enter the next erase block if it is free */
+        if (cs == 0xFFFFFFFF) return cs;
+        if (cs) goto found;
+      }
+    }
+  }
+
+  /* Find a free erase block from the last one taken on */
+  n_au = (fs->n_fatent - 2 + fs->au_ofs + fs->au_clust - 1) / fs->au_clust;
+  k = fs->au_next;
+  for (i = 0; k < n_au && i < n_au; i++) {
+    if (k || !fs->au_ofs) {    /* (Skip the partial block in front of cluster 2) */
+      ncl = k * fs->au_clust + 2 - fs->au_ofs;
+      cs = au_free(fs, ncl);
+      if (cs == 0xFFFFFFFF) return cs;
+      if (cs) {
+        fs->au_next = k + 1;
+        goto found;
+      }
+    }
+    if (++k == n_au) k = 0;
+  }
+  fs->au_next = n_au;        /* No free erase block until clusters are freed */
+  return create_chain(fs, clst);  /* Take any free cluster */
+
+found:
+  res = put_fat(fs, ncl, 0x0FFFFFFF);  /* Mark the new cluster "last link" */
+  if (res == FR_OK && clst != 0) {
+    res = put_fat(fs, clst, ncl);  /* Link it to the previous one if needed */
+  }
+  if (res == FR_OK) {
+    if (fs->free_clust != 0xFFFFFFFF) {  /* Update FSINFO */
+      fs->free_clust--;
+      fs->fsi_flag = 1;
+    }
+  } else {
+    ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+  }
+
+  return ncl;    /* Return new cluster number or error code */
+}
+#else
+#define create_chain_au(fs, clst)  create_chain(fs, clst)
+#endif
+
+
+
+#if _FS_EXFAT
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Stretch or Create the cluster chain of a file        */
+/*-----------------------------------------------------------------------*/
+/* A file stays contiguous while each new cluster follows the last one,  */
+/* so it needs no FAT entries at all. When it gets fragmented, the FAT   */
+/* chain of its clusters so far is written and the file goes on as a     */
+/* FAT chain.                                                            */
+
+static
+DWORD create_xchain (  /* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+  FIL *fp,      /* File object */
+  DWORD clst      /* Cluster# to stretch. 0 means create a new chain. */
+)
+{
+  FATFS *fs = fp->fs;
+  DWORD cs, ncl, cl;
+  FRESULT res;
+
+
+  if (clst == 0) {    /* Create a new chain */
+    ncl = alloc_xclust(fs, fs->last_clust);
+    if (ncl >= 2 && ncl != 0xFFFFFFFF) fp->stat = 2;  /* A new file is contiguous */
+    return ncl;
+  }
+
+  if (fp->stat == 2) {  /* Contiguous file: is it already followed by next cluster? */
+    if ((FSIZE_t)(clst - fp->sclust + 1) * SZ_CLUST(fs) < fp->fsize) return clst + 1;
+  } else {        /* FAT chain */
+    cs = get_fat(fs, clst);
+    if (cs < 2) return 1;
+    if (cs == 0xFFFFFFFF) return cs;
+    if (cs < fs->n_fatent) return cs;
+  }
+
+  ncl = alloc_xclust(fs, clst + 1);  /* Continue contiguously if possible */
+  if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;
+
+  res = FR_OK;
+  if (fp->stat == 2 && ncl != clst + 1) {  /* The file gets fragmented */
+    for (cl = fp->sclust; res == FR_OK && cl < clst; cl++)
+      res = put_fat(fs, cl, cl + 1);  /* Create the FAT chain of the file so far */
+    fp->stat = 0;
+  }
+  if (fp->stat != 2) {
+    if (res == FR_OK) res = put_fat(fs, clst, ncl);  /* Link the new cluster */
+    if (res == FR_OK) res = put_fat(fs, ncl, 0x0FFFFFFF);
+  }
+  if (res != FR_OK) ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+
+  return ncl;    /* Return new cluster number or error code */
+}
+
+#define create_fchain(fp, clst)  ((fp)->fs->fs_type == FS_EXFAT ? create_xchain(fp, clst) : create_chain_au((fp)->fs, clst))
+#else
+#define create_fchain(fp, clst)  create_chain_au((fp)->fs, clst)
+#endif
 #endif /* !_FS_READONLY */
 
 
@@ -1068,14 +1736,14 @@ FRESULT dir_sdi (
 )
 {
   DWORD clst;
-  WORD ic;
+  UINT ic;
 
 
   dj->index = idx;
   clst = dj->sclust;
   if (clst == 1 || clst >= dj->fs->n_fatent)  /* Check start cluster range */
     return FR_INT_ERR;
-  if (!clst && dj->fs->fs_type == FS_FAT32)  /* Replace cluster# 0 with root cluster# if in FAT32 */
+  if (!clst && dj->fs->fs_type >= FS_FAT32)  /* Replace cluster# 0 with root cluster# if in FAT32/exFAT */
     clst = dj->fs->dirbase;
 
   if (clst == 0) {  /* Static table (root-dir in FAT12/16) */
@@ -1087,7 +1755,11 @@ FRESULT dir_sdi (
   else {        /* Dynamic table (sub-dirs or root-dir in FAT32) */
     ic = SS(dj->fs) / SZ_DIR * dj->fs->csize;  /* Entries per cluster */
     while (idx >= ic) {  /* Follow cluster chain */
+#if _FS_EXFAT
+      clst = dj->ncl ? clst + 1 : get_fat(dj->fs, clst);  /* Get next cluster (contiguous table needs no FAT) */
+#else
       clst = get_fat(dj->fs, clst);        /* Get next cluster */
+#endif
       if (clst == 0xFFFFFFFF) return FR_DISK_ERR;  /* Disk error */
       if (clst < 2 || clst >= dj->fs->n_fatent)  /* Reached to end of table or int error */
         return FR_INT_ERR;
@@ -1133,13 +1805,21 @@ FRESULT dir_next (  /* FR_OK:Succeeded, FR_NO_FILE:End of table, FR_DENIED:EOT a
     }
     else {          /* Dynamic table */
       if (((i / (SS(dj->fs) / SZ_DIR)) & (dj->fs->csize - 1)) == 0) {  /* Cluster changed? */
+#if _FS_EXFAT
+        if (dj->ncl)                /* Contiguous table */
+          clst = (dj->clust - dj->sclust + 1 >= dj->ncl) ? 0x7FFFFFFF : dj->clust + 1;
+        else
+#endif
         clst = get_fat(dj->fs, dj->clust);        /* Get next cluster */
         if (clst <= 1) return FR_INT_ERR;
         if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
         if (clst >= dj->fs->n_fatent) {          /* When it reached end of dynamic table */
 #if !_FS_READONLY
-          BYTE c;
+          UINT c;
           if (!stretch) return FR_NO_FILE;      /* When do not stretch, report EOT */
+#if _FS_EXFAT
+          if (dj->fs->fs_type == FS_EXFAT) return FR_DENIED;  /* exFAT directories are not stretched */
+#endif
           clst = create_chain(dj->fs, dj->clust);    /* Stretch cluster chain */
           if (clst == 0) return FR_DENIED;      /* No free cluster */
           if (clst == 1) return FR_INT_ERR;
@@ -1173,6 +1853,47 @@ FRESULT dir_next (  /* FR_OK:Succeeded, FR_NO_FILE:End of table, FR_DENIED:EOT a
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Load the sector of the current entry             */
+/*-----------------------------------------------------------------------*/
+/* While f_readdirs() has set up a read buffer, the sectors from the     */
+/* current one to the end of the cluster are read into it with a single  */
+/* multiple block read, and dj->dir points into the buffer, not win[].   */
+#if _USE_READDIRS
+static
+FRESULT dir_win (
+  DIR *dj    /* Pointer to directory object */
+)
+{
+  FATFS *fs = dj->fs;
+  DWORD n;
+
+
+  if (!fs->dblk) return move_window(fs, dj->sect);
+
+  if (dj->sect - fs->dbsect >= fs->dbcnt) {  /* Not in the read buffer */
+    if (dj->clust)              /* Sectors left in the cluster */
+      n = fs->csize - (dj->sect - fs->database) % fs->csize;
+    else                  /* Sectors left in the static table */
+      n = fs->dirbase + fs->n_rootdir / (SS(fs) / SZ_DIR) - dj->sect;
+    if (n > fs->dbsize) n = fs->dbsize;
+    fs->dbcnt = 0;
+    if (disk_read(fs->drv, fs->dblk, dj->sect, (BYTE)n) != RES_OK)
+      return FR_DISK_ERR;
+    fs->dbsect = dj->sect;
+    fs->dbcnt = n;
+  }
+  dj->dir = fs->dblk + (dj->sect - fs->dbsect) * SS(fs) + (dj->index % (SS(fs) / SZ_DIR)) * SZ_DIR;
+
+  return FR_OK;
+}
+#else
+#define dir_win(dj)  move_window((dj)->fs, (dj)->sect)
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* LFN handling - Test/Pick/Fit an LFN segment from/to directory entry   */
 /*-----------------------------------------------------------------------*/
@@ -1345,6 +2066,396 @@ BYTE sum_sfn (
 
 
 
+#if _FS_EXFAT
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Sum of an entry set and hash of a name               */
+/*-----------------------------------------------------------------------*/
+
+static
+WORD xsum_ent (
+  const BYTE *dir,  /* Ptr to directory entry */
+  WORD sum,    /* Sum of the preceding entries of the set */
+  int first    /* 1:File entry (its SetChecksum field is not summed) */
+)
+{
+  UINT i;
+
+
+  for (i = 0; i < SZ_DIR; i++) {
+    if (first && (i == XDIR_SetSum || i == XDIR_SetSum + 1)) continue;
+    sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + dir[i];
+  }
+  return sum;
+}
+
+
+static
+WORD xname_sum (
+  const WCHAR *name  /* File name to be hashed */
+)
+{
+  WCHAR wc;
+  WORD sum = 0;
+
+
+  while ((wc = *name++) != 0) {
+    wc = ff_wtoupper(wc);    /* The hash is taken on the up-case name */
+    sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + (wc & 0xFF);
+    sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + (wc >> 8);
+  }
+  return sum;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Get the table of a sub-directory found               */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD xent_ncl (  /* Number of clusters of a contiguous object, 0:FAT chain */
+  DIR *dj    /* Directory object with the entry set in xent[] */
+)
+{
+  FSIZE_t sz;
+  DWORD n;
+
+
+  if (dj->fs->fs_type != FS_EXFAT || !(dj->xent[XDIR_GenFlags] & 2)) return 0;
+  sz = LD_QWORD(dj->xent+XDIR_FileSize);
+  n = (DWORD)((sz + SZ_CLUST(dj->fs) - 1) / SZ_CLUST(dj->fs));
+  return n ? n : 1;
+}
+
+
+static
+void xdir_enter (
+  DIR *dj    /* Directory object with the entry set of a sub-directory in xent[] */
+)
+{
+  dj->sclust = LD_DWORD(dj->xent+XDIR_FstClus);
+  dj->ncl = xent_ncl(dj);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Read or find an entry set in the directory           */
+/*-----------------------------------------------------------------------*/
+/* The file and stream extension entries are kept in xent[] and the name */
+/* is read into lfn[]. On success the object ends at the current index   */
+/* and lfn_idx is the index of its file entry.                           */
+
+static
+FRESULT xdir_read (
+  DIR *dj,    /* Directory object pointing the entry to start from */
+  int find    /* 0:Read the next object, 1:Find the object named in lfn[] */
+)
+{
+  FRESULT res;
+  BYTE c, *dir, *xe = dj->xent;
+  UINT ns = 0, si = 0, nn = 0, ni = 0, i, nlen = 0;
+  WORD sum = 0, hash = 0;
+  WCHAR wc, *lfn = dj->lfn;
+
+
+  if (find) {
+    for (nlen = 0; lfn[nlen]; nlen++) ;
+    hash = xname_sum(lfn);
+  }
+
+  res = FR_NO_FILE;
+  while (dj->sect) {
+    res = dir_win(dj);
+    if (res != FR_OK) break;
+    dir = dj->dir;          /* Ptr to the directory entry of current index */
+    c = dir[XDIR_Type];
+    if (c == 0) { res = FR_NO_FILE; break; }  /* Reached to end of table */
+    if (c == ET_FILE) {        /* Start of an entry set */
+      ns = dir[XDIR_NumSec];
+      if (ns < 2 || ns > 18) {    /* Stream, 1 to 17 names and others */
+        ns = 0;
+      } else {
+        mem_cpy(xe, dir, SZ_DIR);
+        sum = xsum_ent(dir, 0, 1);
+        dj->lfn_idx = dj->index;
+        si = 1;
+      }
+    } else if (ns) {        /* Secondary entries of the set */
+      if ((c & 0xC0) != 0xC0) {    /* A primary or deleted entry breaks the set */
+        ns = 0;
+      } else if (si == 1) {      /* Stream extension entry */
+        if (c != ET_STREAM) {
+          ns = 0;
+        } else {
+          mem_cpy(xe+SZ_DIR, dir, SZ_DIR);
+          nn = xe[XDIR_NumName]; ni = 0;
+          if (!nn || (!find && nn > _MAX_LFN)) ns = 0;
+          if (find && (nn != nlen || LD_WORD(xe+XDIR_NameHash) != hash)) ns = 0;  /* Not the name */
+        }
+      } else if (c == ET_NAME) {    /* File name entry */
+        for (i = 0; i < 15 && ni < nn; i++, ni++) {
+          wc = LD_WORD(dir+XDIR_Name+i*2);
+          if (find) {
+            if (ff_wtoupper(wc) != ff_wtoupper(lfn[ni])) { ns = 0; break; }
+          } else {
+            lfn[ni] = wc;
+          }
+        }
+      }
+      if (ns) {
+        sum = xsum_ent(dir, sum, 0);
+        if (si++ == ns) {      /* End of the set */
+          ns = 0;
+          if (ni == nn && sum == LD_WORD(xe+XDIR_SetSum)) {  /* A valid entry set */
+            if (!find) lfn[ni] = 0;
+            break;
+          }
+        }
+      }
+    }
+    res = dir_next(dj, 0);      /* Next entry */
+    if (res != FR_OK) break;
+  }
+
+  if (res != FR_OK && !find) dj->sect = 0;
+
+  return res;
+}
+
+
+
+
+#if !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Load or store the entry set of an object             */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT xdir_load (
+  DIR *dj    /* Directory object with sclust, ncl and lfn_idx of the set */
+)
+{
+  FRESULT res;
+  UINT i;
+
+
+  res = dir_sdi(dj, dj->lfn_idx);
+  for (i = 0; res == FR_OK; i++) {  /* Load the file and stream extension entries */
+    res = move_window(dj->fs, dj->sect);
+    if (res != FR_OK) break;
+    if (dj->dir[XDIR_Type] != (i ? ET_STREAM : ET_FILE)) { res = FR_INT_ERR; break; }
+    mem_cpy(dj->xent + i * SZ_DIR, dj->dir, SZ_DIR);
+    if (i) break;
+    res = dir_next(dj, 0);
+  }
+  if (res == FR_NO_FILE) res = FR_INT_ERR;
+
+  return res;
+}
+
+
+static
+FRESULT xdir_store (
+  DIR *dj    /* Directory object with the entry set in xent[] */
+)
+{
+  FRESULT res;
+  DWORD sect;
+  UINT i, ns, ofs;
+  WORD sum = 0;
+
+
+  ns = dj->xent[XDIR_NumSec];
+  res = dir_sdi(dj, dj->lfn_idx);
+  if (res != FR_OK) return res;
+  sect = dj->sect; ofs = (UINT)(dj->dir - dj->fs->win);  /* Location of the file entry */
+  for (i = 0; ; i++) {
+    res = move_window(dj->fs, dj->sect);
+    if (res != FR_OK) break;
+    if (i < 2) {          /* Put the file and stream extension entries */
+      mem_cpy(dj->dir, dj->xent + i * SZ_DIR, SZ_DIR);
+      dj->fs->wflag = 1;
+    }
+    sum = xsum_ent(dj->dir, sum, i == 0);  /* Sum the names on the disk as well */
+    if (i == ns) break;
+    res = dir_next(dj, 0);
+    if (res != FR_OK) break;
+  }
+  if (res == FR_OK) {          /* Put the sum into the file entry */
+    ST_WORD(dj->xent+XDIR_SetSum, sum);
+    res = move_window(dj->fs, sect);
+    if (res == FR_OK) {
+      ST_WORD(dj->fs->win+ofs+XDIR_SetSum, sum);
+      dj->fs->wflag = 1;
+    }
+  }
+  if (res == FR_NO_FILE) res = FR_INT_ERR;
+
+  return res;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Register an object to the directory                  */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT xdir_register (  /* FR_OK:Successful, FR_DENIED:No free entry, FR_DISK_ERR:Disk error */
+  DIR *dj    /* Target directory with object name in lfn[] */
+)
+{
+  FRESULT res;
+  UINT n, ne, nn, is, i;
+  BYTE *xe = dj->xent;
+  WCHAR *lfn = dj->lfn;
+
+
+  for (nn = 0; lfn[nn]; nn++) ;
+  ne = (nn + 14) / 15 + 2;      /* File, stream extension and name entries */
+
+  /* Reserve contiguous entries */
+  res = dir_sdi(dj, 0);
+  if (res != FR_OK) return res;
+  n = is = 0;
+  do {
+    res = move_window(dj->fs, dj->sect);
+    if (res != FR_OK) break;
+    if (!(*dj->dir & 0x80)) {    /* Is it a blank or deleted entry? */
+      if (n == 0) is = dj->index;
+      if (++n == ne) break;
+    } else {
+      n = 0;
+    }
+    res = dir_next(dj, 1);      /* Next entry (the table is not stretched) */
+  } while (res == FR_OK);
+  if (res == FR_NO_FILE) res = FR_DENIED;
+  if (res != FR_OK) return res;
+
+  /* Put the name entries */
+  res = dir_sdi(dj, (WORD)(is + 2));
+  for (n = 0; res == FR_OK && n < nn; ) {
+    res = move_window(dj->fs, dj->sect);
+    if (res != FR_OK) break;
+    mem_set(dj->dir, 0, SZ_DIR);
+    dj->dir[XDIR_Type] = ET_NAME;
+    for (i = 0; i < 15 && n < nn; i++, n++) {
+      ST_WORD(dj->dir+XDIR_Name+i*2, lfn[n]);
+    }
+    dj->fs->wflag = 1;
+    if (n < nn) res = dir_next(dj, 0);
+  }
+  if (res == FR_NO_FILE) res = FR_INT_ERR;
+
+  if (res == FR_OK) {    /* Initialize the file and stream extension entries */
+    mem_set(xe, 0, 2 * SZ_DIR);
+    xe[XDIR_Type] = ET_FILE;
+    xe[XDIR_NumSec] = (BYTE)(ne - 1);
+    xe[SZ_DIR+XDIR_Type] = ET_STREAM;
+    xe[XDIR_GenFlags] = 1;
+    xe[XDIR_NumName] = (BYTE)nn;
+    ST_WORD(xe+XDIR_NameHash, xname_sum(lfn));
+    dj->lfn_idx = (WORD)is;
+    res = xdir_store(dj);
+  }
+
+  return res;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Truncate an existing file to be overwritten          */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT xdir_reset (
+  DIR *dj    /* Directory object with the entry set of the file in xent[] */
+)
+{
+  FRESULT res;
+  DWORD cl, ncl;
+
+
+  cl = LD_DWORD(dj->xent+XDIR_FstClus);  /* Get start cluster */
+  ncl = xent_ncl(dj);
+  ST_DWORD(dj->xent+XDIR_CrtTime, get_fattime());  /* Created time */
+  dj->xent[XDIR_Attr] = 0;        /* Reset attribute */
+  dj->xent[XDIR_GenFlags] = 1;
+  mem_set(dj->xent+XDIR_ValidFileSize, 0, 24);  /* size = 0, cluster = 0 */
+  res = xdir_store(dj);
+  if (res == FR_OK && cl) {        /* Remove the clusters if exist */
+    res = remove_obj(dj->fs, cl, ncl);
+    if (res == FR_OK) dj->fs->last_clust = cl - 1;  /* Reuse the cluster hole */
+  }
+
+  return res;
+}
+
+
+
+
+#if !_FS_MINIMIZE
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Create a directory                                   */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT xdir_mkdir (
+  DIR *dj,    /* Target directory with the new name in lfn[] */
+  DWORD tim    /* Created time */
+)
+{
+  FRESULT res;
+  FATFS *fs = dj->fs;
+  DWORD dcl, dsc;
+  UINT n;
+
+
+  dcl = alloc_xclust(fs, fs->last_clust);  /* Allocate a cluster for the new directory table */
+  if (dcl == 0) return FR_DENIED;
+  if (dcl == 0xFFFFFFFF) return FR_DISK_ERR;
+  res = move_window(fs, 0);        /* Flush the bitmap */
+  if (res == FR_OK) {            /* Clear the new directory table (no dot entries on exFAT) */
+    dsc = clust2sect(fs, dcl);
+    mem_set(fs->win, 0, SS(fs));
+    for (n = fs->csize; n; n--) {
+      fs->winsect = dsc++;
+      fs->wflag = 1;
+      res = move_window(fs, 0);
+      if (res != FR_OK) break;
+    }
+  }
+  if (res == FR_OK) res = xdir_register(dj);  /* Register the object to the directoy */
+  if (res == FR_OK) {
+    dj->xent[XDIR_Attr] = AM_DIR;      /* Attribute */
+    ST_DWORD(dj->xent+XDIR_CrtTime, tim);  /* Created time */
+    ST_DWORD(dj->xent+XDIR_ModTime, tim);
+    dj->xent[XDIR_GenFlags] = 3;      /* Contiguous table */
+    ST_DWORD(dj->xent+XDIR_FstClus, dcl);  /* Table start cluster */
+    ST_QWORD(dj->xent+XDIR_FileSize, SZ_CLUST(fs));
+    ST_QWORD(dj->xent+XDIR_ValidFileSize, SZ_CLUST(fs));
+    res = xdir_store(dj);
+  }
+  if (res == FR_OK)
+    res = sync(fs);
+  else
+    remove_obj(fs, dcl, 1);        /* Could not register, free the cluster */
+
+  return res;
+}
+#endif
+#endif /* !_FS_READONLY */
+#endif /* _FS_EXFAT */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
@@ -1362,6 +2473,9 @@ FRESULT dir_find (
 
   res = dir_sdi(dj, 0);      /* Rewind directory object */
   if (res != FR_OK) return res;
+#if _FS_EXFAT
+  if (dj->fs->fs_type == FS_EXFAT) return xdir_read(dj, 1);
+#endif
 
 #if _USE_LFN
   ord = sum = 0xFF;
@@ -1421,9 +2535,12 @@ FRESULT dir_read (
   BYTE a, ord = 0xFF, sum = 0xFF;
 #endif
 
+#if _FS_EXFAT
+  if (dj->fs->fs_type == FS_EXFAT) return xdir_read(dj, 0);
+#endif
   res = FR_NO_FILE;
   while (dj->sect) {
-    res = move_window(dj->fs, dj->sect);
+    res = dir_win(dj);
     if (res != FR_OK) break;
     dir = dj->dir;          /* Ptr to the directory entry of current index */
     c = dir[DIR_Name];
@@ -1480,6 +2597,9 @@ FRESULT dir_register (  /* FR_OK:Successful, FR_DENIED:No free entry or too many
   WCHAR *lfn;
 
 
+#if _FS_EXFAT
+  if (dj->fs->fs_type == FS_EXFAT) return xdir_register(dj);
+#endif
   fn = dj->fn; lfn = dj->lfn;
   mem_cpy(sn, fn, 12);
 
@@ -1589,6 +2709,11 @@ FRESULT dir_remove (  /* FR_OK: Successful, FR_DISK_ERR: A disk error */
     do {
       res = move_window(dj->fs, dj->sect);
       if (res != FR_OK) break;
+#if _FS_EXFAT
+      if (dj->fs->fs_type == FS_EXFAT)
+        *dj->dir &= 0x7F;    /* Clear the in-use bit of the entry set */
+      else
+#endif
       *dj->dir = DDE;      /* Mark the entry "deleted" */
       dj->fs->wflag = 1;
       if (dj->index >= i) break;  /* When reached SFN, all entries of the object has been deleted. */
@@ -1842,9 +2967,32 @@ void get_fileinfo (    /* No return code */
   UINT i;
   BYTE nt, *dir;
   TCHAR *p, c;
+#if _FS_EXFAT
+  WCHAR w;
+#endif
 
 
   p = fno->fname;
+#if _FS_EXFAT
+  if (dj->sect && dj->fs->fs_type == FS_EXFAT) {  /* exFAT has no SFN, put the name if it fits */
+    for (i = 0; i < 12 && dj->lfn[i]; i++) ;
+    if (dj->lfn[i]) {
+      *p++ = '?';
+    } else {
+      for (i = 0; (w = dj->lfn[i]) != 0; i++) {
+#if !_LFN_UNICODE
+        w = ff_convert(w, 0);      /* Unicode -> OEM conversion */
+        if (!w || w >= 0x100) w = '?';
+#endif
+        *p++ = (TCHAR)w;
+      }
+    }
+    fno->fattrib = dj->xent[XDIR_Attr];        /* Attribute */
+    fno->fsize = LD_QWORD(dj->xent+XDIR_FileSize);  /* Size */
+    fno->ftime = LD_WORD(dj->xent+XDIR_ModTime);    /* Time */
+    fno->fdate = LD_WORD(dj->xent+XDIR_ModTime+2);  /* Date */
+  } else
+#endif
   if (dj->sect) {
     dir = dj->dir;
     nt = dir[DIR_NTres];    /* NT flag */
@@ -1911,6 +3059,171 @@ void get_fileinfo (    /* No return code */
 
 
 
+#if _FS_PCACHE
+/*-----------------------------------------------------------------------*/
+/* Path cache - Get the directory part of a path                         */
+/*-----------------------------------------------------------------------*/
+/* A directory is cached by its path and the directory the path starts   */
+/* from. Entries of an earlier mount of the volume (id) are void, and    */
+/* the cache is cleared at each mount so that a reused FATFS object or a */
+/* wrapped mount ID cannot hit a stale entry.                            */
+
+static
+UINT pc_dir (    /* Length of the path up to the last segment, 0:No directory part */
+  const TCHAR *path  /* Path with the heading separator stripped */
+)
+{
+  UINT i, n = 0, d = 0;
+
+
+  for (i = 0; (UINT)path[i] >= ' '; i++) {
+    if (path[i] == '/' || path[i] == '\\') {
+      if (i && path[i-1] != '/' && path[i-1] != '\\') n = i;  /* End of a segment */
+    } else {
+      if (i && (path[i-1] == '/' || path[i-1] == '\\')) d = n;  /* Start of a segment */
+    }
+  }
+
+  return d < _PCACHE_LEN ? d : 0;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Path cache - Find a directory                                         */
+/*-----------------------------------------------------------------------*/
+
+static
+PCENT* pc_find (  /* Pointer to the entry, 0:Not cached */
+  FATFS *fs,    /* File system object */
+  DWORD base,    /* Directory the path starts from */
+  const TCHAR *path,  /* Path of the directory */
+  UINT len    /* Length of the path */
+)
+{
+  PCENT *pc;
+  UINT i, n;
+
+
+  if (!len) return 0;
+  for (i = 0; i < _FS_PCACHE; i++) {
+    pc = &fs->pcache[i];
+    if (pc->id == fs->id && pc->len == len && pc->base == base) {
+      for (n = 0; n < len && pc->path[n] == path[n]; n++) ;
+      if (n == len) {
+        pc->used = ++fs->pcstamp;
+        return pc;
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Path cache - Register a directory                                     */
+/*-----------------------------------------------------------------------*/
+/* The entry of an earlier mount or the least recently used one is       */
+/* replaced.                                                             */
+
+static
+void pc_put (
+  FATFS *fs,    /* File system object */
+  DWORD base,    /* Directory the path starts from */
+  const TCHAR *path,  /* Path of the directory */
+  UINT len,    /* Length of the path (1.._PCACHE_LEN-1) */
+  DWORD sclust,  /* Table start cluster of the directory */
+  DWORD ncl    /* exFAT: Clusters of a contiguous table */
+)
+{
+  PCENT *pc = 0;
+  UINT i;
+
+
+  (void)ncl;    /* To suppress warning on non-exFAT cfg. */
+  if (!len || len >= _PCACHE_LEN || pc_find(fs, base, path, len)) return;
+  for (i = 0; i < _FS_PCACHE; i++) {
+    if (fs->pcache[i].id != fs->id) { pc = &fs->pcache[i]; break; }
+    if (!pc || fs->pcache[i].used - pc->used > 0x80000000) pc = &fs->pcache[i];  /* Older than the oldest so far */
+  }
+  pc->id = fs->id;
+  pc->len = (WORD)len;
+  pc->base = base;
+  pc->sclust = sclust;
+#if _FS_EXFAT
+  pc->ncl = ncl;
+#endif
+  pc->used = ++fs->pcstamp;
+  for (i = 0; i < len; i++) pc->path[i] = path[i];
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Path cache - Forget a removed directory                               */
+/*-----------------------------------------------------------------------*/
+
+static
+void pc_drop (
+  FATFS *fs,    /* File system object */
+  DWORD sclust  /* Table start cluster of the directory (0:All directories) */
+)
+{
+  UINT i;
+
+
+  for (i = 0; i < _FS_PCACHE; i++) {
+    if (!sclust || fs->pcache[i].sclust == sclust || fs->pcache[i].base == sclust) {
+      fs->pcache[i].id = 0;
+      fs->pcache[i].len = 0;  /* Never matched, even by a mount ID of 0 */
+    }
+  }
+  if (!sclust) fs->pcstamp = 0;
+}
+
+
+
+
+#if !_FS_READONLY
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Path cache - Register a new directory                                 */
+/*-----------------------------------------------------------------------*/
+
+static
+void pc_mkdir (
+  DIR *dj,    /* Directory object of the new directory */
+  const TCHAR *path,  /* Path given to f_mkdir() */
+  DWORD sclust,  /* Table start cluster of the new directory */
+  DWORD ncl    /* exFAT: Clusters of a contiguous table */
+)
+{
+  DWORD base = 0;
+  UINT n;
+
+
+#if _FS_RPATH
+  if (*path != '/' && *path != '\\') base = dj->fs->cdir;
+#endif
+  if (*path == '/' || *path == '\\') path++;
+  for (n = 0; (UINT)path[n] >= ' '; n++) ;
+  while (n && (path[n-1] == '/' || path[n-1] == '\\')) n--;  /* Strip trailing separators */
+  pc_put(dj->fs, base, path, n, sclust, ncl);
+}
+#endif
+#endif /* _FS_PCACHE */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Follow a file path                                                    */
 /*-----------------------------------------------------------------------*/
@@ -1923,8 +3236,17 @@ FRESULT follow_path (  /* FR_OK(0): successful, !=0: error code */
 {
   FRESULT res;
   BYTE *dir, ns;
+#if _FS_PCACHE
+  const TCHAR *top;
+  DWORD base;
+  UINT plen;
+  PCENT *pc;
+#endif
 
 
+#if _FS_EXFAT
+  dj->ncl = 0;              /* Tables are followed on the FAT */
+#endif
 #if _FS_RPATH
   if (*path == '/' || *path == '\\') { /* There is a heading separator */
     path++;  dj->sclust = 0;    /* Strip it and start from the root dir */
@@ -1942,6 +3264,18 @@ FRESULT follow_path (  /* FR_OK(0): successful, !=0: error code */
     dj->dir = 0;
 
   } else {              /* Follow path */
+#if _FS_PCACHE
+    top = path; base = dj->sclust;
+    plen = pc_dir(path);
+    pc = pc_find(dj->fs, base, path, plen);
+    if (pc) {              /* The directory part is cached, go there at once */
+      dj->sclust = pc->sclust;
+#if _FS_EXFAT
+      dj->ncl = pc->ncl;
+#endif
+      path += plen;
+    }
+#endif
     for (;;) {
       res = create_name(dj, &path);  /* Get a segment */
       if (res != FR_OK) break;
@@ -1961,11 +3295,24 @@ FRESULT follow_path (  /* FR_OK(0): successful, !=0: error code */
       }
       if (ns & NS_LAST) break;      /* Last segment match. Function completed. */
       dir = dj->dir;            /* There is next segment. Follow the sub directory */
-      if (!(dir[DIR_Attr] & AM_DIR)) {  /* Cannot follow because it is a file */
+      if (!(OBJ_ATTR(dj) & AM_DIR)) {  /* Cannot follow because it is a file */
         res = FR_NO_PATH; break;
       }
+#if _FS_EXFAT
+      if (dj->fs->fs_type == FS_EXFAT)
+        xdir_enter(dj);
+      else
+#endif
       dj->sclust = LD_CLUST(dir);
     }
+#if _FS_PCACHE
+    if (!pc && plen && (res == FR_OK || res == FR_NO_FILE) && (ns & NS_LAST))  /* The directory part has been followed */
+#if _FS_EXFAT
+      pc_put(dj->fs, base, top, plen, dj->sclust, dj->ncl);
+#else
+      pc_put(dj->fs, base, top, plen, dj->sclust, 0);
+#endif
+#endif
   }
 
   return res;
@@ -1989,13 +3336,97 @@ BYTE check_fs (  /* 0:FAT-VBR, 1:Valid BR but not FAT, 2:Not a BR, 3:Disk error
   if (LD_WORD(&fs->win[BS_55AA]) != 0xAA55)    /* Check record signature (always placed at offset 510 even if the sector size is >512) */
     return 2;
 
-  if ((LD_DWORD(&fs->win[BS_FilSysType]) & 0xFFFFFF) == 0x544146)  /* Check "FAT" string */
-    return 0;
-  if ((LD_DWORD(&fs->win[BS_FilSysType32]) & 0xFFFFFF) == 0x544146)
-    return 0;
+  if ((LD_DWORD(&fs->win[BS_FilSysType]) & 0xFFFFFF) == 0x544146)  /* Check "FAT" string */
+    return 0;
+  if ((LD_DWORD(&fs->win[BS_FilSysType32]) & 0xFFFFFF) == 0x544146)
+    return 0;
+#if _FS_EXFAT
+  if (!mem_cmp(&fs->win[BS_OEMName], "EXFAT   ", 8))  /* Check "EXFAT" string */
+    return 0;
+#endif
+
+  return 1;
+}
+
+
+
+
+#if _FS_EXFAT
+/*-----------------------------------------------------------------------*/
+/* Initialize the file system object for an exFAT volume                 */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT mount_exfat (  /* FR_OK(0): successful, !=0: any error occurred */
+  FATFS *fs,  /* File system object with the exFAT VBR in the win[] */
+  DWORD bsect  /* Sector# of the VBR */
+)
+{
+  FRESULT res;
+  DIR dj;
+  QWORD maxlba;
+  DWORD nclst, clst, n, i;
+  BYTE b;
+
+
+  if (LD_WORD(fs->win+BPB_FSVerEx) >> 8 != 1)  /* (Revision 1.x) */
+    return FR_NO_FILESYSTEM;
+  b = fs->win[BPB_BytsPerSecEx];          /* (Sector size must be equal to the physical sector size) */
+  if (b > 12 || 1U << b != SS(fs))
+    return FR_NO_FILESYSTEM;
+  maxlba = LD_QWORD(fs->win+BPB_TotSecEx) + bsect;
+  if (maxlba >> 32) return FR_NO_FILESYSTEM;    /* (Sector# must fit in 32 bits for disk_read) */
+
+  b = fs->win[BPB_SecPerClusEx];          /* Cluster size */
+  if (b > 15) return FR_NO_FILESYSTEM;      /* (Up to 32768 sectors, csize is a WORD) */
+  fs->csize = 1 << b;
+
+  fs->n_fats = fs->win[BPB_NumFATsEx];
+  if (fs->n_fats != 1) return FR_NO_FILESYSTEM;  /* (TexFAT is not supported) */
+
+  nclst = LD_DWORD(fs->win+BPB_NumClusEx);    /* Number of clusters */
+  if (!nclst || nclst > 0x7FFFFFF5) return FR_NO_FILESYSTEM;
+  fs->n_fatent = nclst + 2;
+  fs->n_rootdir = 0;
 
-  return 1;
+  fs->fsize = LD_DWORD(fs->win+BPB_FatSzEx);    /* Sectors per FAT */
+  if (fs->fsize < (fs->n_fatent + SS(fs) / 4 - 1) / (SS(fs) / 4))  /* (FAT must hold all clusters) */
+    return FR_NO_FILESYSTEM;
+  fs->fatbase = bsect + LD_DWORD(fs->win+BPB_FatOfsEx);
+  fs->database = bsect + LD_DWORD(fs->win+BPB_DataOfsEx);
+  if (fs->database + (QWORD)nclst * fs->csize > maxlba)  /* (Invalid volume size) */
+    return FR_NO_FILESYSTEM;
+  fs->dirbase = LD_DWORD(fs->win+BPB_RootClusEx);  /* Root directory start cluster */
+  if (fs->dirbase < 2 || fs->dirbase >= fs->n_fatent) return FR_NO_FILESYSTEM;
+
+  /* Find the allocation bitmap in the root directory */
+  fs->fs_type = FS_EXFAT;
+  fs->winsect = 0;    /* The win[] holds the VBR, not a root directory sector */
+  fs->wflag = 0;
+  dj.fs = fs; dj.sclust = 0; dj.ncl = 0;
+  res = dir_sdi(&dj, 0);
+  for (;;) {
+    if (res != FR_OK) return (res == FR_NO_FILE) ? FR_NO_FILESYSTEM : res;
+    res = move_window(fs, dj.sect);
+    if (res != FR_OK) return res;
+    if (dj.dir[XDIR_Type] == 0) return FR_NO_FILESYSTEM;  /* (No bitmap) */
+    if (dj.dir[XDIR_Type] == ET_BITMAP && !(dj.dir[1] & 1)) break;  /* The first bitmap */
+    res = dir_next(&dj, 0);
+  }
+  clst = LD_DWORD(dj.dir+XDIR_FstClus-SZ_DIR);    /* Bitmap start cluster and size */
+  if (clst < 2 || clst >= fs->n_fatent) return FR_NO_FILESYSTEM;
+  if (LD_QWORD(dj.dir+XDIR_FileSize-SZ_DIR) < (nclst + 7) / 8) return FR_NO_FILESYSTEM;
+
+  /* The bitmap is addressed by sector, it must be contiguous */
+  n = ((nclst + 7) / 8 + SZ_CLUST(fs) - 1) / SZ_CLUST(fs);
+  for (i = 1; i < n; i++) {
+    if (get_fat(fs, clst + i - 1) != clst + i) return FR_NO_FILESYSTEM;
+  }
+  fs->bitbase = clust2sect(fs, clst);
+
+  return FR_OK;
 }
+#endif
 
 
 
@@ -2014,6 +3445,9 @@ FRESULT chk_mounted (  /* FR_OK(0): successful, !=0: any error occurred */
   BYTE fmt, b, pi, *tbl;
   UINT vol;
   DSTATUS stat;
+#if _FS_EXFAT
+  FRESULT res;
+#endif
   DWORD bsect, fasize, tsect, sysect, nclst, szbfat;
   WORD nrsv;
   const TCHAR *p = *path;
@@ -2052,6 +3486,9 @@ FRESULT chk_mounted (  /* FR_OK(0): successful, !=0: any error occurred */
   /* Following code attempts to mount the volume. (analyze BPB and initialize the fs object) */
 
   fs->fs_type = 0;          /* Clear the file system object */
+#if _USE_READDIRS
+  fs->dblk = 0;            /* No directory read buffer */
+#endif
   fs->drv = LD2PD(vol);        /* Bind the logical drive and a physical drive */
   stat = disk_initialize(fs->drv);  /* Initialize low level disk I/O layer */
   if (stat & STA_NOINIT)        /* Check if the initialization succeeded */
@@ -2078,6 +3515,18 @@ FRESULT chk_mounted (  /* FR_OK(0): successful, !=0: any error occurred */
   if (fmt == 3) return FR_DISK_ERR;
   if (fmt) return FR_NO_FILESYSTEM;    /* No FAT volume is found */
 
+#if _FS_EXFAT
+  if (!mem_cmp(fs->win+BS_OEMName, "EXFAT   ", 8)) {  /* An exFAT volume is found */
+    res = mount_exfat(fs, bsect);
+    if (res != FR_OK) {
+      fs->fs_type = 0;
+      return res;
+    }
+    fmt = FS_EXFAT;
+    goto mounted;
+  }
+#endif
+
   /* An FAT volume is found. Following code initializes the file system object */
 
   if (LD_WORD(fs->win+BPB_BytsPerSec) != SS(fs))    /* (BPB_BytsPerSec must be equal to the physical sector size) */
@@ -2111,6 +3560,7 @@ FRESULT chk_mounted (  /* FR_OK(0): successful, !=0: any error occurred */
   fmt = FS_FAT12;
   if (nclst >= MIN_FAT16) fmt = FS_FAT16;
   if (nclst >= MIN_FAT32) fmt = FS_FAT32;
+  if (!FAT_ENABLED(fmt)) return FR_NO_FILESYSTEM;  /* (The FAT type is not built in) */
 
   /* Boundaries and Limits */
   fs->n_fatent = nclst + 2;              /* Number of FAT entries */
@@ -2129,10 +3579,20 @@ FRESULT chk_mounted (  /* FR_OK(0): successful, !=0: any error occurred */
   if (fs->fsize < (szbfat + (SS(fs) - 1)) / SS(fs))  /* (BPB_FATSz must not be less than required) */
     return FR_NO_FILESYSTEM;
 
+#if _FS_EXFAT
+mounted:
+#endif
 #if !_FS_READONLY
   /* Initialize cluster allocation information */
   fs->free_clust = 0xFFFFFFFF;
   fs->last_clust = 0;
+#if _FS_AUALLOC
+  fs->au_clust = fs->au_ofs = fs->au_next = 0;
+  if (disk_ioctl(fs->drv, GET_BLOCK_SIZE, (BYTE*)&szbfat) == RES_OK && szbfat > fs->csize) {
+    fs->au_clust = szbfat / fs->csize;      /* Clusters per erase block */
+    fs->au_ofs = fs->database % szbfat / fs->csize;
+  }
+#endif
 
   /* Get fsinfo if available */
   if (fmt == FS_FAT32) {
@@ -2157,6 +3617,9 @@ FRESULT chk_mounted (  /* FR_OK(0): successful, !=0: any error occurred */
 #if _FS_SHARE        /* Clear file lock semaphores */
   clear_lock(fs);
 #endif
+#if _FS_PCACHE
+  pc_drop(fs, 0);      /* Clear the path cache */
+#endif
 
   return FR_OK;
 }
@@ -2188,6 +3651,54 @@ FRESULT validate (  /* FR_OK(0): The object is valid, !=0: Invalid */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Read whole sectors and a partial sector in a single transfer          */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT read_vec (  /* FR_OK(0):succeeded, !=0:error */
+  FIL *fp,    /* Pointer to the file object */
+  BYTE *rbuff,  /* Data buffer for the whole sectors */
+  DWORD sect,    /* First sector to read */
+  UINT cc,    /* Number of whole sectors */
+  BYTE head    /* Partial sector is 1:the first sector, 0:the last sector */
+)
+{
+  DISKVEC vec[2];
+
+
+#if _FS_TINY
+  if (move_window(fp->fs, 0))      /* Write-back dirty window */
+    return FR_DISK_ERR;
+  fp->fs->winsect = 0xFFFFFFFF;    /* Invalidate window while it is overwritten */
+  vec[head ? 0 : 1].buff = fp->fs->win;
+#else
+#if !_FS_READONLY
+  if (fp->flag & FA__DIRTY) {      /* Write-back dirty sector cache */
+    if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+      return FR_DISK_ERR;
+    fp->flag &= ~FA__DIRTY;
+  }
+#endif
+  vec[head ? 0 : 1].buff = fp->buf;
+#endif
+  vec[head ? 0 : 1].count = 1;
+  vec[head ? 1 : 0].buff = rbuff;
+  vec[head ? 1 : 0].count = cc;
+  if (disk_readv(fp->fs->drv, vec, 2, sect) != RES_OK)
+    return FR_DISK_ERR;
+#if _FS_TINY
+  fp->fs->winsect = head ? sect : sect + cc;  /* The partial sector is in the window */
+#else
+  fp->dsect = head ? sect : sect + cc;    /* The partial sector is in the sector cache */
+#endif
+
+  return FR_OK;
+}
+
+
+
+
 /*--------------------------------------------------------------------------
 
    Public Functions
@@ -2224,8 +3735,17 @@ FRESULT f_mount (
 
   if (fs) {
     fs->fs_type = 0;    /* Clear new fs object */
+#if _FS_PCACHE
+    pc_drop(fs, 0);
+#endif
 #if _FS_REENTRANT        /* Create sync object for the new volume */
     if (!ff_cre_syncobj(vol, &fs->sobj)) return FR_INT_ERR;
+#if _FS_SHARE && _VOLUMES > 1  /* Create sync object for the file lock table on first mount */
+    if (!FilesSobjOk) {
+      if (!ff_cre_syncobj(_VOLUMES, &FilesSobj)) return FR_INT_ERR;
+      FilesSobjOk = 1;
+    }
+#endif
 #endif
   }
   FatFs[vol] = fs;      /* Register new fs object */
@@ -2253,6 +3773,7 @@ FRESULT f_open (
 
 
   fp->fs = 0;      /* Clear file object */
+  fp->xflag = (mode & FA_DIRECT) ? FX_DIRECT : 0;  /* Application keeps the transfers sector aligned? */
 
 #if !_FS_READONLY
   mode &= FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS | FA_CREATE_NEW;
@@ -2290,13 +3811,18 @@ FRESULT f_open (
       dir = dj.dir;          /* New entry */
     }
     else {                /* Any object is already existing */
-      if (dir[DIR_Attr] & (AM_RDO | AM_DIR)) {  /* Cannot overwrite it (R/O or DIR) */
+      if (OBJ_ATTR(&dj) & (AM_RDO | AM_DIR)) {  /* Cannot overwrite it (R/O or DIR) */
         res = FR_DENIED;
       } else {
         if (mode & FA_CREATE_NEW)  /* Cannot create as new file */
           res = FR_EXIST;
       }
     }
+#if _FS_EXFAT
+    if (res == FR_OK && (mode & FA_CREATE_ALWAYS) && dj.fs->fs_type == FS_EXFAT)
+      res = xdir_reset(&dj);        /* Truncate it in the entry set */
+    else
+#endif
     if (res == FR_OK && (mode & FA_CREATE_ALWAYS)) {  /* Truncate it if overwrite mode */
       dw = get_fattime();          /* Created time */
       ST_DWORD(dir+DIR_CrtTime, dw);
@@ -2317,10 +3843,10 @@ FRESULT f_open (
   }
   else {  /* Open an existing file */
     if (res == FR_OK) {            /* Follow succeeded */
-      if (dir[DIR_Attr] & AM_DIR) {    /* It is a directory */
+      if (OBJ_ATTR(&dj) & AM_DIR) {    /* It is a directory */
         res = FR_NO_FILE;
       } else {
-        if ((mode & FA_WRITE) && (dir[DIR_Attr] & AM_RDO)) /* R/O violation */
+        if ((mode & FA_WRITE) && (OBJ_ATTR(&dj) & AM_RDO)) /* R/O violation */
           res = FR_DENIED;
       }
     }
@@ -2330,6 +3856,11 @@ FRESULT f_open (
       mode |= FA__WRITTEN;
     fp->dir_sect = dj.fs->winsect;      /* Pointer to the directory entry */
     fp->dir_ptr = dir;
+#if _FS_EXFAT
+    fp->dir_idx = dj.lfn_idx;        /* Location of the entry set */
+    fp->dir_sclust = dj.sclust;
+    fp->dir_ncl = dj.ncl;
+#endif
 #if _FS_SHARE
     fp->lockid = inc_lock(&dj, (mode & ~FA_READ) ? 1 : 0);
     if (!fp->lockid) res = FR_INT_ERR;
@@ -2341,7 +3872,7 @@ FRESULT f_open (
     if (!dir) {            /* Current dir itself */
       res = FR_INVALID_NAME;
     } else {
-      if (dir[DIR_Attr] & AM_DIR)  /* It is a directory */
+      if (OBJ_ATTR(&dj) & AM_DIR)  /* It is a directory */
         res = FR_NO_FILE;
     }
   }
@@ -2350,8 +3881,11 @@ FRESULT f_open (
 
   if (res == FR_OK) {
     fp->flag = mode;          /* File access mode */
-    fp->sclust = LD_CLUST(dir);      /* File start cluster */
-    fp->fsize = LD_DWORD(dir+DIR_FileSize);  /* File size */
+    fp->sclust = OBJ_CLUST(&dj);      /* File start cluster */
+    fp->fsize = OBJ_SIZE(&dj);      /* File size */
+#if _FS_EXFAT
+    fp->stat = (dj.fs->fs_type == FS_EXFAT) ? dj.xent[XDIR_GenFlags] & 2 : 0;  /* Contiguous file? */
+#endif
     fp->fptr = 0;            /* File pointer */
     fp->dsect = 0;
 #if _USE_FASTSEEK
@@ -2378,9 +3912,10 @@ FRESULT f_read (
 )
 {
   FRESULT res;
-  DWORD clst, sect, remain;
-  UINT rcnt, cc;
-  BYTE csect, *rbuff = buff;
+  DWORD clst, sect;
+  FSIZE_t remain;
+  UINT rcnt, cc, csect;
+  BYTE *rbuff = buff;
 
 
   *br = 0;  /* Initialize byte counter */
@@ -2392,12 +3927,14 @@ FRESULT f_read (
   if (!(fp->flag & FA_READ))           /* Check access mode */
     LEAVE_FF(fp->fs, FR_DENIED);
   remain = fp->fsize - fp->fptr;
+  if ((fp->xflag & FX_DIRECT) && remain && ((UINT)fp->fptr | btr) % SS(fp->fs))  /* Direct mode takes whole sectors only */
+    LEAVE_FF(fp->fs, FR_INVALID_PARAMETER);
   if (btr > remain) btr = (UINT)remain;    /* Truncate btr by remaining bytes */
 
   for ( ;  btr;                /* Repeat until all data read */
     rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
     if ((fp->fptr % SS(fp->fs)) == 0) {    /* On the sector boundary? */
-      csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));  /* Sector offset in the cluster */
+      csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));  /* Sector offset in the cluster */
       if (!csect) {            /* On the cluster boundary? */
         if (fp->fptr == 0) {      /* On the top of the file? */
           clst = fp->sclust;      /* Follow from the origin */
@@ -2407,7 +3944,7 @@ FRESULT f_read (
             clst = clmt_clust(fp, fp->fptr);  /* Get cluster# from the CLMT */
           else
 #endif
-            clst = get_fat(fp->fs, fp->clust);  /* Follow cluster chain on the FAT */
+            clst = next_clust(fp, fp->clust);  /* Follow cluster chain on the FAT */
         }
         if (clst < 2) ABORT(fp->fs, FR_INT_ERR);
         if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
@@ -2417,9 +3954,20 @@ FRESULT f_read (
       if (!sect) ABORT(fp->fs, FR_INT_ERR);
       sect += csect;
       cc = btr / SS(fp->fs);        /* When remaining bytes >= sector size, */
+      if (fp->xflag & FX_DIRECT)      /* Direct mode: the buffer also has room for the last sector of the file */
+        cc = (btr + SS(fp->fs) - 1) / SS(fp->fs);
       if (cc) {              /* Read maximum contiguous sectors directly */
         if (csect + cc > fp->fs->csize)  /* Clip at cluster boundary */
           cc = fp->fs->csize - csect;
+#if _FS_EXFAT
+        if (cc > 128) cc = 128;      /* Clip at the sector count of a disk_read() */
+#endif
+        if (!(fp->xflag & FX_DIRECT) && csect + cc < fp->fs->csize && btr % SS(fp->fs)) {  /* Partial last sector in this cluster? */
+          if (read_vec(fp, rbuff, sect, cc, 0))  /* Read it into the sector buffer in the same transfer */
+            ABORT(fp->fs, FR_DISK_ERR);
+          rcnt = SS(fp->fs) * cc;
+          continue;
+        }
         if (disk_read(fp->fs->drv, rbuff, sect, (BYTE)cc) != RES_OK)
           ABORT(fp->fs, FR_DISK_ERR);
 #if !_FS_READONLY && _FS_MINIMIZE <= 2      /* Replace one of the read sectors with cached data if it contains a dirty sector */
@@ -2432,6 +3980,7 @@ FRESULT f_read (
 #endif
 #endif
         rcnt = SS(fp->fs) * cc;      /* Number of bytes transferred */
+        if (rcnt > btr) rcnt = btr;    /* Direct mode: end of file in the last sector */
         continue;
       }
 #if !_FS_TINY
@@ -2452,6 +4001,17 @@ FRESULT f_read (
     rcnt = SS(fp->fs) - (fp->fptr % SS(fp->fs));  /* Get partial sector data from sector buffer */
     if (rcnt > btr) rcnt = btr;
 #if _FS_TINY
+    csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));  /* Sector offset in the cluster */
+    cc = (btr - rcnt) / SS(fp->fs);
+    if (fp->fs->winsect != fp->dsect && cc && csect + 1 < fp->fs->csize) {  /* Whole sectors follow in this cluster? */
+      if (csect + 1 + cc > fp->fs->csize)  /* Clip at cluster boundary */
+        cc = fp->fs->csize - csect - 1;
+      if (read_vec(fp, rbuff + rcnt, fp->dsect, cc, 1))  /* Read them directly with the first sector */
+        ABORT(fp->fs, FR_DISK_ERR);
+      mem_cpy(rbuff, &fp->fs->win[fp->fptr % SS(fp->fs)], rcnt);  /* Pick partial sector */
+      rcnt += SS(fp->fs) * cc;
+      continue;
+    }
     if (move_window(fp->fs, fp->dsect))    /* Move sector window */
       ABORT(fp->fs, FR_DISK_ERR);
     mem_cpy(rbuff, &fp->fs->win[fp->fptr % SS(fp->fs)], rcnt);  /* Pick partial sector */
@@ -2480,9 +4040,8 @@ FRESULT f_write (
 {
   FRESULT res;
   DWORD clst, sect;
-  UINT wcnt, cc;
+  UINT wcnt, cc, csect;
   const BYTE *wbuff = buff;
-  BYTE csect;
 
 
   *bw = 0;  /* Initialize byte counter */
@@ -2493,24 +4052,29 @@ FRESULT f_write (
     LEAVE_FF(fp->fs, FR_INT_ERR);
   if (!(fp->flag & FA_WRITE))        /* Check access mode */
     LEAVE_FF(fp->fs, FR_DENIED);
+  if ((fp->xflag & FX_DIRECT) && ((UINT)fp->fptr | btw) % SS(fp->fs))  /* Direct mode takes whole sectors only */
+    LEAVE_FF(fp->fs, FR_INVALID_PARAMETER);
+#if _FS_EXFAT
+  if (fp->fs->fs_type != FS_EXFAT)
+#endif
   if ((DWORD)(fp->fsize + btw) < fp->fsize) btw = 0;  /* File size cannot reach 4GB */
 
   for ( ;  btw;              /* Repeat until all data written */
     wbuff += wcnt, fp->fptr += wcnt, *bw += wcnt, btw -= wcnt) {
     if ((fp->fptr % SS(fp->fs)) == 0) {  /* On the sector boundary? */
-      csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));  /* Sector offset in the cluster */
+      csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));  /* Sector offset in the cluster */
       if (!csect) {          /* On the cluster boundary? */
         if (fp->fptr == 0) {    /* On the top of the file? */
           clst = fp->sclust;    /* Follow from the origin */
           if (clst == 0)      /* When no cluster is allocated, */
-            fp->sclust = clst = create_chain(fp->fs, 0);  /* Create a new cluster chain */
+            fp->sclust = clst = create_fchain(fp, 0);  /* Create a new cluster chain */
         } else {          /* Middle or end of the file */
 #if _USE_FASTSEEK
           if (fp->cltbl)
             clst = clmt_clust(fp, fp->fptr);  /* Get cluster# from the CLMT */
           else
 #endif
-            clst = create_chain(fp->fs, fp->clust);  /* Follow or stretch cluster chain on the FAT */
+            clst = create_fchain(fp, fp->clust);  /* Follow or stretch cluster chain on the FAT */
         }
         if (clst == 0) break;    /* Could not allocate a new cluster (disk full) */
         if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
@@ -2534,11 +4098,17 @@ FRESULT f_write (
       if (cc) {            /* Write maximum contiguous sectors directly */
         if (csect + cc > fp->fs->csize)  /* Clip at cluster boundary */
           cc = fp->fs->csize - csect;
+#if _FS_EXFAT
+        if (cc > 128) cc = 128;      /* Clip at the sector count of a disk_write() */
+#endif
         if (disk_write(fp->fs->drv, (BYTE*)wbuff, sect, (BYTE)cc) != RES_OK)
           ABORT(fp->fs, FR_DISK_ERR);
 #if _FS_TINY
         if (fp->fs->winsect - sect < cc) {  /* Refill sector cache if it gets invalidated by the direct write */
-          mem_cpy(fp->fs->win, wbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), SS(fp->fs));
+          if (fp->xflag & FX_DIRECT)
+            fp->fs->winsect = 0xFFFFFFFF;  /* Direct mode: drop it rather than copying data into the window */
+          else
+            mem_cpy(fp->fs->win, wbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), SS(fp->fs));
           fp->fs->wflag = 0;
         }
 #else
@@ -2608,6 +4178,29 @@ FRESULT f_sync (
           LEAVE_FF(fp->fs, FR_DISK_ERR);
         fp->flag &= ~FA__DIRTY;
       }
+#endif
+#if _FS_EXFAT
+      if (fp->fs->fs_type == FS_EXFAT) {  /* Update the entry set */
+        DIR dj;
+
+        dj.fs = fp->fs; dj.sclust = fp->dir_sclust; dj.ncl = fp->dir_ncl;
+        dj.lfn_idx = fp->dir_idx;
+        res = xdir_load(&dj);
+        if (res == FR_OK) {
+          dj.xent[XDIR_Attr] |= AM_ARC;        /* Set archive bit */
+          ST_DWORD(dj.xent+XDIR_ModTime, get_fattime());  /* Update updated time */
+          dj.xent[XDIR_GenFlags] = fp->sclust ? fp->stat | 1 : 1;  /* Contiguous or FAT chain */
+          ST_DWORD(dj.xent+XDIR_FstClus, fp->sclust);  /* Update start cluster */
+          ST_QWORD(dj.xent+XDIR_FileSize, fp->fsize);  /* Update file size */
+          ST_QWORD(dj.xent+XDIR_ValidFileSize, fp->fsize);
+          res = xdir_store(&dj);
+          if (res == FR_OK) {
+            fp->flag &= ~FA__WRITTEN;
+            res = sync(fp->fs);
+          }
+        }
+        LEAVE_FF(fp->fs, res);
+      }
 #endif
       /* Update the directory entry */
       res = move_window(fp->fs, fp->dir_sect);
@@ -2803,7 +4396,7 @@ FRESULT f_getcwd (
 
 FRESULT f_lseek (
   FIL *fp,    /* Pointer to the file object */
-  DWORD ofs    /* File pointer from top of file */
+  FSIZE_t ofs    /* File pointer from top of file */
 )
 {
   FRESULT res;
@@ -2852,7 +4445,7 @@ FRESULT f_lseek (
         dsc = clust2sect(fp->fs, fp->clust);
         if (!dsc) ABORT(fp->fs, FR_INT_ERR);
         dsc += (ofs - 1) / SS(fp->fs) & (fp->fs->csize - 1);
-        if (fp->fptr % SS(fp->fs) && dsc != fp->dsect) {  /* Refill sector cache if needed */
+        if (fp->fptr % SS(fp->fs) && dsc != fp->dsect && !(fp->xflag & FX_DIRECT)) {  /* Refill sector cache if needed */
 #if !_FS_TINY
 #if !_FS_READONLY
           if (fp->flag & FA__DIRTY) {    /* Write-back dirty sector cache */
@@ -2873,13 +4466,18 @@ FRESULT f_lseek (
 
   /* Normal Seek */
   {
-    DWORD clst, bcs, nsect, ifptr;
+    DWORD clst, bcs, nsect;
+    FSIZE_t ifptr;
 
     if (ofs > fp->fsize          /* In read-only mode, clip offset with the file size */
 #if !_FS_READONLY
        && !(fp->flag & FA_WRITE)
 #endif
       ) ofs = fp->fsize;
+#if _FS_EXFAT
+    if (fp->fs->fs_type != FS_EXFAT && ofs > 0xFFFFFFFF)  /* File size cannot reach 4GB on FAT */
+      ofs = 0xFFFFFFFF;
+#endif
 
     ifptr = fp->fptr;
     fp->fptr = nsect = 0;
@@ -2887,14 +4485,14 @@ FRESULT f_lseek (
       bcs = (DWORD)fp->fs->csize * SS(fp->fs);  /* Cluster size (byte) */
       if (ifptr > 0 &&
         (ofs - 1) / bcs >= (ifptr - 1) / bcs) {  /* When seek to same or following cluster, */
-        fp->fptr = (ifptr - 1) & ~(bcs - 1);  /* start from the current cluster */
+        fp->fptr = (ifptr - 1) & ~(FSIZE_t)(bcs - 1);  /* start from the current cluster */
         ofs -= fp->fptr;
         clst = fp->clust;
       } else {                  /* When seek to back cluster, */
         clst = fp->sclust;            /* start from the first cluster */
 #if !_FS_READONLY
         if (clst == 0) {            /* If no cluster chain, create a new chain */
-          clst = create_chain(fp->fs, 0);
+          clst = create_fchain(fp, 0);
           if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
           if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
           fp->sclust = clst;
@@ -2903,16 +4501,39 @@ FRESULT f_lseek (
         fp->clust = clst;
       }
       if (clst != 0) {
+#if _FS_EXFAT
+        if (fp->stat == 2 && fp->fptr + ofs <= fp->fsize) {  /* Contiguous file: get the cluster without following */
+          DWORD n = (DWORD)((ofs - 1) / bcs);
+
+          clst += n; fp->clust = clst;
+          fp->fptr += (FSIZE_t)n * bcs;
+          ofs -= (FSIZE_t)n * bcs;
+        }
+#endif
+        if (ofs > bcs
+#if !_FS_READONLY
+          && (!(fp->flag & FA_WRITE) || fp->fptr + ofs <= fp->fsize)
+#endif
+          ) {                /* The chain is there, follow it in one walk */
+          DWORD n = (DWORD)((ofs - 1) / bcs);
+
+          clst = walk_fat(fp->fs, clst, n);
+          if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+          if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
+          fp->clust = clst;
+          fp->fptr += (FSIZE_t)n * bcs;
+          ofs -= (FSIZE_t)n * bcs;
+        }
         while (ofs > bcs) {            /* Cluster following loop */
 #if !_FS_READONLY
           if (fp->flag & FA_WRITE) {      /* Check if in write mode or not */
-            clst = create_chain(fp->fs, clst);  /* Force stretch if in write mode */
+            clst = create_fchain(fp, clst);  /* Force stretch if in write mode */
             if (clst == 0) {        /* When disk gets full, clip file size */
               ofs = bcs; break;
             }
           } else
 #endif
-            clst = get_fat(fp->fs, clst);  /* Follow cluster chain if not in write mode */
+            clst = next_clust(fp, clst);  /* Follow cluster chain if not in write mode */
           if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
           if (clst <= 1 || clst >= fp->fs->n_fatent) ABORT(fp->fs, FR_INT_ERR);
           fp->clust = clst;
@@ -2923,11 +4544,11 @@ FRESULT f_lseek (
         if (ofs % SS(fp->fs)) {
           nsect = clust2sect(fp->fs, clst);  /* Current sector */
           if (!nsect) ABORT(fp->fs, FR_INT_ERR);
-          nsect += ofs / SS(fp->fs);
+          nsect += (DWORD)(ofs / SS(fp->fs));
         }
       }
     }
-    if (fp->fptr % SS(fp->fs) && nsect != fp->dsect) {  /* Fill sector cache if needed */
+    if (fp->fptr % SS(fp->fs) && nsect != fp->dsect && !(fp->xflag & FX_DIRECT)) {  /* Fill sector cache if needed */
 #if !_FS_TINY
 #if !_FS_READONLY
       if (fp->flag & FA__DIRTY) {      /* Write-back dirty sector cache */
@@ -2975,7 +4596,12 @@ FRESULT f_opendir (
     FREE_BUF();
     if (res == FR_OK) {            /* Follow completed */
       if (dj->dir) {            /* It is not the root dir */
-        if (dj->dir[DIR_Attr] & AM_DIR) {  /* The object is a directory */
+        if (OBJ_ATTR(dj) & AM_DIR) {  /* The object is a directory */
+#if _FS_EXFAT
+          if (dj->fs->fs_type == FS_EXFAT)
+            xdir_enter(dj);
+          else
+#endif
           dj->sclust = LD_CLUST(dj->dir);
         } else {            /* The object is not a directory */
           res = FR_NO_PATH;
@@ -3031,8 +4657,442 @@ FRESULT f_readdir (
     }
   }
 
-  LEAVE_FF(dj->fs, res);
+  LEAVE_FF(dj->fs, res);
+}
+
+
+
+#if _USE_READDIRS
+/*-----------------------------------------------------------------------*/
+/* Match a name against a wildcard pattern ('?' and '*')                 */
+/*-----------------------------------------------------------------------*/
+
+static
+int match_name (  /* 1:Matched, 0:Not matched */
+  const TCHAR *pat,  /* Pattern */
+  const TCHAR *nam  /* Name */
+)
+{
+  const TCHAR *bp = 0, *bn = 0;
+  TCHAR p, c;
+
+
+  for (;;) {
+    if (*pat == '*') {      /* Remember where the star can take more chars from */
+      bp = ++pat; bn = nam;
+      continue;
+    }
+    p = *pat; c = *nam;
+    if (!c && !p) return 1;
+    if (IsLower(p)) p -= 0x20;
+    if (IsLower(c)) c -= 0x20;
+    if (c && (p == '?' || p == c)) {
+      pat++; nam++;
+      continue;
+    }
+    if (!bp || !*bn) return 0;  /* Mismatch and no star to stretch */
+    pat = bp; nam = ++bn;
+  }
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Directory Items in Bulk                                          */
+/*-----------------------------------------------------------------------*/
+/* Fills up to n items with the objects that follow in the directory,    */
+/* reading a cluster at a time into buff. Objects with any attribute in  */
+/* skip or a name that does not match pat (if not null) are left out.    */
+/* The pattern is matched against the long name as well, which is read   */
+/* into the lfname buffer of each item as f_readdir() does.              */
+/* It returns with *cnt < n only at the end of the directory.            */
+
+FRESULT f_readdirs (
+  DIR *dj,      /* Pointer to the open directory object */
+  DIRITEM *item,    /* Pointer to the array of items to return */
+  UINT n,        /* Number of items in the array */
+  UINT *cnt,      /* Pointer to return the number of items filled */
+  void *buff,      /* Read buffer */
+  UINT btr,      /* Size of the read buffer in bytes (at least a sector) */
+  const TCHAR *pat,  /* Pattern of the names (null:All) */
+  BYTE skip      /* Attributes of the objects to be left out */
+)
+{
+  FRESULT res;
+  FATFS *fs;
+  FILINFO fno;
+  DWORD clst;
+  UINT i, nsect;
+  DEF_NAMEBUF;
+
+
+  *cnt = 0;
+  res = validate(dj->fs, dj->id);      /* Check validity of the object */
+  if (res == FR_OK) {
+    fs = dj->fs;
+    nsect = btr / SS(fs);
+    if (nsect > 128) nsect = 128;
+    if (!nsect) res = FR_INVALID_PARAMETER;
+    if (res == FR_OK)
+      res = move_window(fs, 0);      /* The directory is read from the disk, write back the window */
+    if (res == FR_OK) {
+      INIT_BUF(*dj);
+      fs->dblk = buff;
+      fs->dbcnt = 0;
+      while (*cnt < n && dj->sect) {
+        fs->dbsize = (n - *cnt) / (SS(fs) / SZ_DIR) + 1;  /* Do not read far beyond the items asked for */
+        if (fs->dbsize > nsect) fs->dbsize = nsect;
+        res = dir_read(dj);        /* Read an directory item */
+        if (res != FR_OK) break;
+#if _USE_LFN
+        fno.lfname = item->lfname;    /* LFN is put in the item in place */
+        fno.lfsize = item->lfsize;
+#endif
+        get_fileinfo(dj, &fno);
+        clst = OBJ_CLUST(dj);      /* dj->dir is moved by dir_next() */
+        res = dir_next(dj, 0);      /* Increment index for next */
+        if (!(fno.fattrib & skip) && (!pat || match_name(pat, fno.fname)
+#if _USE_LFN
+          || (fno.lfname && fno.lfname[0] && match_name(pat, fno.lfname))
+#endif
+          )) {
+          item->fsize = fno.fsize;
+          item->sclust = clst;
+          item->fattrib = fno.fattrib;
+          for (i = 0; i < 13; i++) item->fname[i] = fno.fname[i];
+          item++; (*cnt)++;
+        }
+        if (res != FR_OK) break;
+      }
+      if (res == FR_NO_FILE) {      /* Reached end of dir */
+        dj->sect = 0;
+        res = FR_OK;
+      }
+      fs->dblk = 0;
+      FREE_BUF();
+    }
+  }
+
+  LEAVE_FF(dj->fs, res);
+}
+#endif /* _USE_READDIRS */
+
+
+
+#if _USE_FRAGSTAT
+/*-----------------------------------------------------------------------*/
+/* Fragmentation report - Read a FAT or bitmap sector through the buffer */
+/*-----------------------------------------------------------------------*/
+/* The buffer is filled with one multiple block read of the sectors from */
+/* sect on, up to the end of the area.                                   */
+
+#define FRAG_PATH  80    /* Size of the path buffer in TCHAR */
+#define FRAG_DEPTH  8    /* Deepest directory level entered */
+
+typedef struct {
+  FATFS *fs;      /* File system object */
+  FRAGSTAT *st;    /* Statistics */
+  BYTE *buf;      /* Read buffer */
+  UINT nsect;      /* Size of the read buffer in sectors */
+  DWORD bsect;    /* First sector in the read buffer */
+  UINT nload;      /* Sectors in the read buffer */
+  void (*func)(const TCHAR*, FSIZE_t, DWORD);  /* Called for each file */
+  TCHAR path[FRAG_PATH];  /* Path of the directory and the file */
+} FRAGWALK;
+
+static
+BYTE* frag_sect (  /* Pointer to the sector data, 0:Disk error */
+  FRAGWALK *fw,  /* Walk object */
+  DWORD sect,    /* Sector number */
+  DWORD end    /* End of the area (FAT or allocation bitmap) */
+)
+{
+  if (sect - fw->bsect >= fw->nload) {
+    fw->nload = fw->nsect;
+    if (fw->nload > end - sect) fw->nload = end - sect;
+    if (disk_read(fw->fs->drv, fw->buf, sect, (BYTE)fw->nload) != RES_OK) {
+      fw->nload = 0;
+      return 0;
+    }
+    fw->bsect = sect;
+  }
+
+  return fw->buf + (sect - fw->bsect) * SS(fw->fs);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Fragmentation report - Get a FAT entry                                */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD frag_fat (  /* 0xFFFFFFFF:Disk error, Else:Cluster status */
+  FRAGWALK *fw,  /* Walk object */
+  DWORD clst    /* Cluster# */
+)
+{
+  FATFS *fs = fw->fs;
+  BYTE *p;
+  DWORD ofs;
+
+
+  if (fs->fs_type == FS_FAT12) return get_fat(fs, clst);  /* FAT12 entries straddle sectors */
+
+  ofs = (fs->fs_type == FS_FAT16) ? clst * 2 : clst * 4;
+  p = frag_sect(fw, fs->fatbase + ofs / SS(fs), fs->fatbase + fs->fsize);
+  if (!p) return 0xFFFFFFFF;
+  p += ofs % SS(fs);
+  if (fs->fs_type == FS_FAT16) return LD_WORD(p);
+  return LD_DWORD(p) & 0x0FFFFFFF;  /* FAT32, or exFAT where 0xFFFFFFFF ends a chain */
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Fragmentation report - Scan the free clusters                         */
+/*-----------------------------------------------------------------------*/
+
+static
+void frag_run (
+  FRAGSTAT *st,  /* Statistics */
+  DWORD scl,    /* First cluster of a free run */
+  DWORD n      /* Number of clusters */
+)
+{
+  UINT i;
+
+
+  st->free_clust += n;
+  st->free_runs++;
+  for (i = 0; n >> i > 1 && i < 15; i++) ;
+  st->run_hist[i]++;
+  if (n > st->max_run) {
+    st->max_run = n;
+    st->max_run_clust = scl;
+  }
+}
+
+
+static
+FRESULT frag_free (
+  FRAGWALK *fw  /* Walk object */
+)
+{
+  FATFS *fs = fw->fs;
+  DWORD clst, v, run = 0;
+#if _FS_EXFAT
+  BYTE *p;
+#endif
+
+
+  for (clst = 2; clst < fs->n_fatent; clst++) {
+#if _FS_EXFAT
+    if (fs->fs_type == FS_EXFAT) {    /* The allocation bitmap tells the free clusters */
+      p = frag_sect(fw, fs->bitbase + (clst - 2) / 8 / SS(fs),
+        fs->bitbase + ((fs->n_fatent - 2 + 7) / 8 + SS(fs) - 1) / SS(fs));
+      if (!p) return FR_DISK_ERR;
+      v = p[(clst - 2) / 8 % SS(fs)] & (1 << ((clst - 2) % 8));
+    } else
+#endif
+    {
+      v = frag_fat(fw, clst);
+      if (v == 0xFFFFFFFF) return FR_DISK_ERR;
+    }
+    if (v == 0) {
+      run++;
+    } else if (run) {
+      frag_run(fw->st, clst - run, run);
+      run = 0;
+    }
+  }
+  if (run) frag_run(fw->st, clst - run, run);
+
+  return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Fragmentation report - Walk a directory and its sub-directories       */
+/*-----------------------------------------------------------------------*/
+/* The walk is not recursive, the sub-directories being walked are kept  */
+/* in an array so that the stack use is known at build time.             */
+
+static
+FRESULT frag_dir (
+  FRAGWALK *fw,  /* Walk object */
+  DIR *top,    /* Directory object, the path of the directory is in fw->path */
+  UINT plen    /* Length of the path */
+)
+{
+  FRESULT res;
+  FRAGSTAT *st = fw->st;
+  FATFS *fs = fw->fs;
+  FILINFO fno;
+  DIR sub[FRAG_DEPTH], *dj;
+  UINT pl[FRAG_DEPTH + 1];
+  DWORD clst, ncl, nxt, ext;
+  UINT i, n, depth = 0;
+
+
+  st->dirs++;
+  pl[0] = plen;
+  res = dir_sdi(top, 0);
+  for (;;) {
+    dj = depth ? &sub[depth - 1] : top;
+    plen = pl[depth];
+    if (res == FR_OK) res = dir_read(dj);
+    if (res == FR_NO_FILE && depth) {  /* End of a sub-directory, go on with its parent */
+      depth--;
+      res = dir_next(depth ? &sub[depth - 1] : top, 0);
+      continue;
+    }
+    if (res != FR_OK) break;
+    clst = OBJ_CLUST(dj);
+#if _USE_LFN
+    fno.lfname = fw->path + plen;    /* The LFN goes right into the path */
+    fno.lfsize = FRAG_PATH - plen;
+#endif
+    get_fileinfo(dj, &fno);
+    if (fs->fs_type != FS_EXFAT && fno.fname[0] == '.'  /* Skip the dot entries (FAT only) */
+      && (!fno.fname[1] || (fno.fname[1] == '.' && !fno.fname[2]))) {
+      res = dir_next(dj, 0);
+      continue;
+    }
+#if _USE_LFN
+    if (!fw->path[plen])
+#endif
+    {
+      for (i = 0; fno.fname[i]; i++) fw->path[plen + i] = fno.fname[i];
+      fw->path[plen + i] = 0;
+    }
+    for (n = plen; fw->path[n]; n++) ;
+
+    if (fno.fattrib & AM_DIR) {      /* Enter the sub-directory if there is room for its files */
+      if (depth < FRAG_DEPTH && n + 14 < FRAG_PATH) {
+        sub[depth] = *dj;
+#if _FS_EXFAT
+        if (fs->fs_type == FS_EXFAT)
+          xdir_enter(&sub[depth]);
+        else
+#endif
+        sub[depth].sclust = clst;
+        fw->path[n++] = '/';
+        pl[++depth] = n;
+        st->dirs++;
+        res = dir_sdi(&sub[depth - 1], 0);
+        continue;
+      }
+      st->skipped++;
+    } else {              /* Count the extents of the file */
+      st->files++;
+      ncl = (DWORD)((fno.fsize + SS(fs) * fs->csize - 1) / SS(fs) / fs->csize);
+      ext = 0;
+      if (clst && ncl) {
+        ext = 1;
+#if _FS_EXFAT
+        if (fs->fs_type != FS_EXFAT || !(dj->xent[XDIR_GenFlags] & 2))  /* Not a contiguous file */
+#endif
+        while (--ncl) {
+          nxt = frag_fat(fw, clst);
+          if (nxt == 0xFFFFFFFF) return FR_DISK_ERR;
+          if (nxt < 2 || nxt >= fs->n_fatent) return FR_INT_ERR;  /* Broken chain */
+          if (nxt != clst + 1) ext++;
+          clst = nxt;
+        }
+        st->extents += ext;
+        if (ext > 1) st->fragmented++;
+        if (ext > st->max_extents) st->max_extents = ext;
+        for (i = 0; (ext - 1) >> i && i < 7; i++) ;
+        st->ext_hist[i]++;
+      }
+      if (fw->func) fw->func(fw->path, fno.fsize, ext);
+    }
+    res = dir_next(dj, 0);
+  }
+  if (res == FR_NO_FILE) res = FR_OK;
+
+  return res;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get Fragmentation and Allocation Statistics                           */
+/*-----------------------------------------------------------------------*/
+/* Scans the free space of the volume and walks the directory tree from  */
+/* path on, reading the FAT and the allocation bitmap into buff with     */
+/* multiple block reads. func (if not null) gets the path, the size and  */
+/* the number of extents of each file, it must not access the volume.    */
+
+FRESULT f_fragstat (
+  const TCHAR *path,  /* Pointer to the path of the top directory */
+  FRAGSTAT *st,    /* Pointer to the statistics to be filled */
+  void *buff,      /* Read buffer */
+  UINT btr,      /* Size of the read buffer in bytes (at least a sector) */
+  void (*func)(const TCHAR*, FSIZE_t, DWORD)  /* Function called for each file (null:None) */
+)
+{
+  FRESULT res;
+  DIR dj;
+  FRAGWALK fw;
+  UINT plen;
+  DEF_NAMEBUF;
+
+
+  mem_set(st, 0, sizeof *st);
+  for (plen = 0; path[plen]; plen++) {
+    if (plen >= FRAG_PATH - 14) return FR_INVALID_NAME;
+    fw.path[plen] = path[plen];
+  }
+  if (plen && path[plen - 1] != '/' && path[plen - 1] != ':') fw.path[plen++] = '/';
+
+  res = chk_mounted(&path, &dj.fs, 0);
+  if (res == FR_OK) {
+    fw.fs = dj.fs;
+    fw.st = st;
+    fw.buf = buff;
+    fw.nsect = btr / SS(dj.fs);
+    if (fw.nsect > 128) fw.nsect = 128;
+    fw.nload = 0;
+    fw.func = func;
+    st->n_clust = dj.fs->n_fatent - 2;
+    st->clsize = (DWORD)dj.fs->csize * SS(dj.fs);
+    if (!fw.nsect) res = FR_INVALID_PARAMETER;
+    if (res == FR_OK)
+      res = move_window(dj.fs, 0);    /* The FAT is read from the disk, write back the window */
+    if (res == FR_OK)
+      res = frag_free(&fw);
+    if (res == FR_OK) {
+      INIT_BUF(dj);
+      res = follow_path(&dj, path);    /* Follow the path to the directory */
+      if (res == FR_OK && dj.dir) {    /* It is not the root dir */
+        if (OBJ_ATTR(&dj) & AM_DIR) {
+#if _FS_EXFAT
+          if (dj.fs->fs_type == FS_EXFAT)
+            xdir_enter(&dj);
+          else
+#endif
+          dj.sclust = LD_CLUST(dj.dir);
+        } else {
+          res = FR_NO_PATH;
+        }
+      }
+      if (res == FR_NO_FILE) res = FR_NO_PATH;
+      if (res == FR_OK) res = frag_dir(&fw, &dj, plen);
+      FREE_BUF();
+    }
+  }
+
+  LEAVE_FF(dj.fs, res);
 }
+#endif /* _USE_FRAGSTAT */
 
 
 
@@ -3081,7 +5141,10 @@ FRESULT f_getfree (
 )
 {
   FRESULT res;
-  DWORD n, clst, sect, stat;
+  DWORD n, clst, sect;
+#if _FS_FAT12 || _FS_EXFAT
+  DWORD stat;
+#endif
   UINT i;
   BYTE fat, *p;
 
@@ -3094,8 +5157,29 @@ FRESULT f_getfree (
       *nclst = (*fatfs)->free_clust;
     } else {
       /* Get number of free clusters */
-      fat = (*fatfs)->fs_type;
+      fat = FAT_TYPE(*fatfs);
       n = 0;
+#if _FS_EXFAT
+      if (fat == FS_EXFAT) {    /* Count the clear bits in the allocation bitmap */
+        clst = (*fatfs)->n_fatent - 2;
+        sect = (*fatfs)->bitbase;
+        i = 0; p = 0; stat = 1;
+        do {
+          if (!i) {
+            res = move_window(*fatfs, sect++);
+            if (res != FR_OK) break;
+            p = (*fatfs)->win;
+            i = SS(*fatfs);
+          }
+          if (!(*p & stat)) n++;
+          stat <<= 1;
+          if (stat == 0x100) {
+            stat = 1; p++; i--;
+          }
+        } while (--clst);
+      } else
+#endif
+#if _FS_FAT12
       if (fat == FS_FAT12) {
         clst = 2;
         do {
@@ -3104,25 +5188,23 @@ FRESULT f_getfree (
           if (stat == 1) { res = FR_INT_ERR; break; }
           if (stat == 0) n++;
         } while (++clst < (*fatfs)->n_fatent);
-      } else {
+      } else
+#endif
+      {            /* FAT16/32 entries are counted a sector at a time */
         clst = (*fatfs)->n_fatent;
         sect = (*fatfs)->fatbase;
-        i = 0; p = 0;
-        do {
-          if (!i) {
-            res = move_window(*fatfs, sect++);
-            if (res != FR_OK) break;
-            p = (*fatfs)->win;
-            i = SS(*fatfs);
-          }
+        while (clst) {
+          res = move_window(*fatfs, sect++);
+          if (res != FR_OK) break;
+          p = (*fatfs)->win;
           if (fat == FS_FAT16) {
-            if (LD_WORD(p) == 0) n++;
-            p += 2; i -= 2;
+            for (i = SS(*fatfs) / 2; i && clst; i--, clst--, p += 2)
+              if (LD_WORD(p) == 0) n++;
           } else {
-            if ((LD_DWORD(p) & 0x0FFFFFFF) == 0) n++;
-            p += 4; i -= 4;
+            for (i = SS(*fatfs) / 4; i && clst; i--, clst--, p += 4)
+              if ((LD_DWORD(p) & 0x0FFFFFFF) == 0) n++;
           }
-        } while (--clst);
+        }
       }
       (*fatfs)->free_clust = n;
       if (fat == FS_FAT32) (*fatfs)->fsi_flag = 1;
@@ -3158,11 +5240,20 @@ FRESULT f_truncate (
   }
   if (res == FR_OK) {
     if (fp->fsize > fp->fptr) {
+#if _FS_EXFAT
+      ncl = (fp->stat == 2) ?    /* Number of clusters of a contiguous file */
+        (DWORD)((fp->fsize + SZ_CLUST(fp->fs) - 1) / SZ_CLUST(fp->fs)) : 0;
+#endif
       fp->fsize = fp->fptr;  /* Set file size to current R/W point */
       fp->flag |= FA__WRITTEN;
       if (fp->fptr == 0) {  /* When set file size to zero, remove entire cluster chain */
-        res = remove_chain(fp->fs, fp->sclust);
+        res = remove_obj(fp->fs, fp->sclust, ncl);
         fp->sclust = 0;
+#if _FS_EXFAT
+      } else if (fp->stat == 2) {  /* Contiguous file, free the clusters behind the current one */
+        ncl -= fp->clust - fp->sclust + 1;
+        if (ncl) res = remove_obj(fp->fs, fp->clust + 1, ncl);
+#endif
       } else {        /* When truncate a part of the file, remove remaining clusters */
         ncl = get_fat(fp->fs, fp->clust);
         res = FR_OK;
@@ -3183,6 +5274,333 @@ FRESULT f_truncate (
 
 
 
+#if _USE_EXPAND || _USE_DEFRAG
+/*-----------------------------------------------------------------------*/
+/* Find a Contiguous Free Block                                          */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT find_block (
+  FATFS *fs,    /* File system object */
+  DWORD n,    /* Number of clusters required */
+  DWORD *bcl    /* Pointer to return the first cluster of the block */
+)
+{
+  FRESULT res = FR_OK;
+  DWORD v, clst, stcl, scl, ncl;
+
+
+  stcl = fs->last_clust + 1;        /* Search a free block from the last allocated cluster on */
+  if (stcl < 2 || stcl >= fs->n_fatent) stcl = 2;
+  scl = clst = stcl; ncl = 0;
+  for (;;) {
+#if _FS_EXFAT
+    if (fs->fs_type == FS_EXFAT) {      /* The allocation bitmap tells the free clusters */
+      if (move_window(fs, fs->bitbase + (clst - 2) / 8 / SS(fs))) { res = FR_DISK_ERR; break; }
+      v = fs->win[(clst - 2) / 8 % SS(fs)] & (1 << ((clst - 2) % 8));
+    } else
+#endif
+    {
+      v = get_fat(fs, clst);
+      if (v == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+      if (v == 1) { res = FR_INT_ERR; break; }
+    }
+    if (v == 0) {            /* A free cluster, the block grows */
+      if (++ncl == n) break;      /* Found a large enough block */
+    } else {              /* In use, start over behind it */
+      scl = clst + 1; ncl = 0;
+    }
+    if (++clst >= fs->n_fatent) {    /* A block does not wrap around */
+      scl = clst = 2; ncl = 0;
+    }
+    if (clst == stcl) { res = FR_DENIED; break; }  /* No free block as large as required */
+  }
+  *bcl = scl;
+
+  return res;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Block                                           */
+/*-----------------------------------------------------------------------*/
+/* A FAT volume gets a chain through the block, an exFAT volume only the */
+/* bits in the allocation bitmap.                                        */
+
+static
+FRESULT alloc_block (
+  FATFS *fs,    /* File system object */
+  DWORD scl,    /* First cluster of the block */
+  DWORD n      /* Number of clusters */
+)
+{
+  FRESULT res = FR_OK;
+  DWORD clst;
+
+
+#if _FS_EXFAT
+  if (fs->fs_type == FS_EXFAT) {
+    res = change_bitmap(fs, scl, n, 1);
+  } else
+#endif
+  {
+    for (clst = scl; clst < scl + n && res == FR_OK; clst++)
+      res = put_fat(fs, clst, (clst == scl + n - 1) ? 0x0FFFFFFF : clst + 1);
+  }
+  if (res == FR_OK) {
+    fs->last_clust = scl + n - 1;
+    if (fs->free_clust != 0xFFFFFFFF) {  /* Update free cluster count */
+      fs->free_clust -= n;
+      fs->fsi_flag = 1;
+    }
+  }
+
+  return res;
+}
+#endif
+
+
+
+
+#if _USE_EXPAND
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Block to the File                               */
+/*-----------------------------------------------------------------------*/
+/* The file has to be empty. With opt = 1 the block is allocated and the */
+/* file size set to fsz. With opt = 0 the block is only looked up and    */
+/* the next allocation of the volume starts at its top.                  */
+
+FRESULT f_expand (
+  FIL *fp,    /* Pointer to the file object */
+  FSIZE_t fsz,  /* File size to be expanded to */
+  BYTE opt    /* 0:Find only, 1:Allocate now */
+)
+{
+  FRESULT res;
+  FATFS *fs;
+  DWORD n, scl;
+
+
+  res = validate(fp->fs, fp->id);    /* Check validity of the object */
+  if (res != FR_OK) LEAVE_FF(fp->fs, res);
+  if (fp->flag & FA__ERROR)        /* Check abort flag */
+    LEAVE_FF(fp->fs, FR_INT_ERR);
+  if (fsz == 0 || fp->fsize != 0 || !(fp->flag & FA_WRITE))
+    LEAVE_FF(fp->fs, FR_DENIED);
+  fs = fp->fs;
+#if _FS_EXFAT
+  if (fs->fs_type != FS_EXFAT && fsz > 0xFFFFFFFF)  /* A FAT file cannot reach 4GB */
+    LEAVE_FF(fs, FR_DENIED);
+#endif
+  n = (DWORD)((fsz - 1) / SS(fs) / fs->csize) + 1;  /* Number of clusters required */
+
+  res = find_block(fs, n, &scl);
+  if (res == FR_OK) {
+    if (opt) {              /* Allocate the block */
+      res = alloc_block(fs, scl, n);
+      if (res == FR_OK) {
+#if _FS_EXFAT
+        fp->stat = 2;          /* A contiguous file needs no FAT chain */
+#endif
+        fp->sclust = scl;
+        fp->fsize = fsz;
+        fp->flag |= FA__WRITTEN;
+      }
+    } else {                /* The next allocation starts at the block */
+      fs->last_clust = scl - 1;
+    }
+  }
+
+  LEAVE_FF(fs, res);
+}
+#endif
+
+
+
+
+#if _USE_DEFRAG
+/*-----------------------------------------------------------------------*/
+/* Start Defragmenting a File                                            */
+/*-----------------------------------------------------------------------*/
+/* Allocates a contiguous block for the file when it is fragmented. The  */
+/* data are copied by f_defrag_step(), the file must not be accessed     */
+/* until it reports that nothing is left.                                */
+
+FRESULT f_defrag (
+  DEFRAG *df,    /* Pointer to the defragmenter object */
+  FIL *fp,    /* Pointer to the file object (opened with FA_WRITE) */
+  void *buff,    /* Copy buffer */
+  UINT btr    /* Size of the copy buffer in bytes (at least a sector) */
+)
+{
+  FRESULT res;
+  FATFS *fs;
+  DWORD n, i, clst, nxt;
+
+
+  df->ncl = 0;
+  df->frag = 0;
+  res = f_sync(fp);            /* Write back the cached data first */
+  if (res != FR_OK) return res;
+  res = validate(fp->fs, fp->id);    /* Check validity of the object */
+  if (res != FR_OK) LEAVE_FF(fp->fs, res);
+  if (fp->flag & FA__ERROR)        /* Check abort flag */
+    LEAVE_FF(fp->fs, FR_INT_ERR);
+  if (!(fp->flag & FA_WRITE))      /* The directory entry is rewritten */
+    LEAVE_FF(fp->fs, FR_DENIED);
+  fs = fp->fs;
+  if (btr < SS(fs)) LEAVE_FF(fs, FR_INVALID_PARAMETER);
+  if (!fp->sclust || !fp->fsize) LEAVE_FF(fs, FR_OK);  /* Empty file (it may still have clusters) */
+  df->frag = 1;
+#if _FS_EXFAT
+  if (fp->stat == 2) LEAVE_FF(fs, FR_OK);  /* Contiguous file */
+#endif
+
+  n = (DWORD)((fp->fsize - 1) / SS(fs) / fs->csize) + 1;  /* Number of clusters */
+  clst = fp->sclust;
+  for (i = 1; i < n; i++) {        /* Count the fragments */
+    nxt = get_fat(fs, clst);
+    if (nxt == 0xFFFFFFFF) LEAVE_FF(fs, FR_DISK_ERR);
+    if (nxt < 2 || nxt >= fs->n_fatent) LEAVE_FF(fs, FR_INT_ERR);
+    if (nxt != clst + 1) df->frag++;
+    clst = nxt;
+  }
+  if (df->frag == 1) LEAVE_FF(fs, FR_OK);  /* Already contiguous */
+
+  res = find_block(fs, n, &df->dcl);
+  if (res == FR_OK) res = alloc_block(fs, df->dcl, n);
+  if (res == FR_OK) res = sync(fs);    /* The block is in use before any data go there */
+  if (res == FR_OK) {
+    df->fp = fp;
+    df->buf = buff;
+    df->nsect = btr / SS(fs);
+    if (df->nsect > 128) df->nsect = 128;
+    df->fsize = fp->fsize;
+    df->ncl = n;
+    df->scl = fp->sclust;
+    df->done = 0;
+    df->ofs = 0;
+  }
+
+  LEAVE_FF(fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Copy a Part of the File to the Contiguous Block                       */
+/*-----------------------------------------------------------------------*/
+/* Each call copies up to the size of the copy buffer with one multiple  */
+/* block read and write. After the last part the directory entry is      */
+/* switched to the new block in one sector write and then the old chain  */
+/* is freed, so a power failure leaves the file intact with at worst     */
+/* lost clusters. The file pointer is moved to the top of the file.      */
+
+FRESULT f_defrag_step (
+  DEFRAG *df,    /* Pointer to the defragmenter object */
+  DWORD *left    /* Pointer to return the number of clusters left (0:Finished) */
+)
+{
+  FRESULT res;
+  FATFS *fs;
+  FIL *fp = df->fp;
+  DWORD clst, nxt, sect, old;
+  UINT n;
+
+
+  *left = 0;
+  if (!df->ncl) return FR_OK;
+  res = validate(fp->fs, fp->id);    /* Check validity of the object */
+  if (res != FR_OK) LEAVE_FF(fp->fs, res);
+  fs = fp->fs;
+
+  if (fp->fsize != df->fsize || (fp->flag & FA__ERROR)) {  /* The file has been changed, give up */
+    res = remove_obj(fs, df->dcl, fs->fs_type == FS_EXFAT ? df->ncl : 0);  /* The block is a FAT chain on FAT volumes */
+    if (res == FR_OK) res = sync(fs);
+    df->ncl = 0;
+    LEAVE_FF(fs, res == FR_OK ? FR_DENIED : res);
+  }
+
+  if (df->done < df->ncl) {
+    n = fs->csize - df->ofs;        /* Sectors of the contiguous run from the current one */
+    clst = df->scl;
+    while (n < df->nsect && df->done + (n + df->ofs) / fs->csize < df->ncl) {
+      nxt = get_fat(fs, clst);
+      if (nxt == 0xFFFFFFFF) LEAVE_FF(fs, FR_DISK_ERR);
+      if (nxt != clst + 1) break;
+      n += fs->csize;
+      clst = nxt;
+    }
+    if (n > df->nsect) n = df->nsect;
+    sect = clust2sect(fs, df->dcl + df->done) + df->ofs;
+    if (disk_read(fs->drv, df->buf, clust2sect(fs, df->scl) + df->ofs, (BYTE)n) != RES_OK
+      || disk_write(fs->drv, df->buf, sect, (BYTE)n) != RES_OK)
+      LEAVE_FF(fs, FR_DISK_ERR);
+    if (fs->winsect - sect < n) fs->winsect = 0xFFFFFFFF;  /* The window holds stale data */
+    n += df->ofs;
+    while (n >= fs->csize) {        /* Move on the source chain */
+      n -= fs->csize;
+      if (++df->done == df->ncl) break;
+      nxt = get_fat(fs, df->scl);
+      if (nxt == 0xFFFFFFFF) LEAVE_FF(fs, FR_DISK_ERR);
+      if (nxt < 2 || nxt >= fs->n_fatent) LEAVE_FF(fs, FR_INT_ERR);
+      df->scl = nxt;
+    }
+    df->ofs = n;
+    if (df->done < df->ncl) {
+      *left = df->ncl - df->done;
+      LEAVE_FF(fs, FR_OK);
+    }
+  }
+
+  if (disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)  /* The copy is on the disk */
+    LEAVE_FF(fs, FR_DISK_ERR);
+  old = fp->sclust;
+#if _FS_EXFAT
+  if (fs->fs_type == FS_EXFAT) {        /* Switch the entry set to the contiguous block */
+    DIR dj;
+
+    dj.fs = fs; dj.sclust = fp->dir_sclust; dj.ncl = fp->dir_ncl;
+    dj.lfn_idx = fp->dir_idx;
+    res = xdir_load(&dj);
+    if (res == FR_OK) {
+      dj.xent[XDIR_GenFlags] = 3;
+      ST_DWORD(dj.xent+XDIR_FstClus, df->dcl);
+      res = xdir_store(&dj);
+    }
+  } else
+#endif
+  {                    /* Switch the directory entry to the block */
+    res = move_window(fs, fp->dir_sect);
+    if (res == FR_OK) {
+      ST_CLUST(fp->dir_ptr, df->dcl);
+      fs->wflag = 1;
+    }
+  }
+  if (res == FR_OK) res = sync(fs);
+  if (res == FR_OK) {
+    fp->sclust = df->dcl;
+#if _FS_EXFAT
+    if (fs->fs_type == FS_EXFAT) fp->stat = 2;
+#endif
+    fp->fptr = 0;              /* The cached position refers to the old chain */
+    fp->clust = 0;
+    fp->dsect = 0;
+    res = remove_chain(fs, old);      /* Free the old chain */
+    if (res == FR_OK) res = sync(fs);
+  }
+  df->ncl = 0;
+
+  LEAVE_FF(fs, res);
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Delete a File or Directory                                            */
 /*-----------------------------------------------------------------------*/
@@ -3212,17 +5630,22 @@ FRESULT f_unlink (
       if (!dir) {
         res = FR_INVALID_NAME;    /* Cannot remove the start directory */
       } else {
-        if (dir[DIR_Attr] & AM_RDO)
+        if (OBJ_ATTR(&dj) & AM_RDO)
           res = FR_DENIED;    /* Cannot remove R/O object */
       }
-      dclst = LD_CLUST(dir);
-      if (res == FR_OK && (dir[DIR_Attr] & AM_DIR)) {  /* Is it a sub-dir? */
+      dclst = OBJ_CLUST(&dj);
+      if (res == FR_OK && (OBJ_ATTR(&dj) & AM_DIR)) {  /* Is it a sub-dir? */
         if (dclst < 2) {
           res = FR_INT_ERR;
         } else {
           mem_cpy(&sdj, &dj, sizeof(DIR));  /* Check if the sub-dir is empty or not */
           sdj.sclust = dclst;
+#if _FS_EXFAT
+          sdj.ncl = xent_ncl(&dj);
+          res = dir_sdi(&sdj, (WORD)((dj.fs->fs_type == FS_EXFAT) ? 0 : 2));  /* Exclude dot entries (none on exFAT) */
+#else
           res = dir_sdi(&sdj, 2);    /* Exclude dot entries */
+#endif
           if (res == FR_OK) {
             res = dir_read(&sdj);
             if (res == FR_OK      /* Not empty dir */
@@ -3237,8 +5660,11 @@ FRESULT f_unlink (
       if (res == FR_OK) {
         res = dir_remove(&dj);    /* Remove the directory entry */
         if (res == FR_OK) {
+#if _FS_PCACHE
+          if (OBJ_ATTR(&dj) & AM_DIR) pc_drop(dj.fs, dclst);  /* Its clusters can be reused by another directory */
+#endif
           if (dclst)        /* Remove the cluster chain if exist */
-            res = remove_chain(dj.fs, dclst);
+            res = remove_obj(dj.fs, dclst, xent_ncl(&dj));
           if (res == FR_OK) res = sync(dj.fs);
         }
       }
@@ -3261,7 +5687,8 @@ FRESULT f_mkdir (
 {
   FRESULT res;
   DIR dj;
-  BYTE *dir, n;
+  BYTE *dir;
+  UINT n;
   DWORD dsc, dcl, pcl, tim = get_fattime();
   DEF_NAMEBUF;
 
@@ -3273,6 +5700,16 @@ FRESULT f_mkdir (
     if (res == FR_OK) res = FR_EXIST;    /* Any object with same name is already existing */
     if (_FS_RPATH && res == FR_NO_FILE && (dj.fn[NS] & NS_DOT))
       res = FR_INVALID_NAME;
+#if _FS_EXFAT
+    if (res == FR_NO_FILE && dj.fs->fs_type == FS_EXFAT) {
+      res = xdir_mkdir(&dj, tim);
+#if _FS_PCACHE
+      if (res == FR_OK) pc_mkdir(&dj, path, LD_DWORD(dj.xent+XDIR_FstClus), 1);
+#endif
+      FREE_BUF();
+      LEAVE_FF(dj.fs, res);
+    }
+#endif
     if (res == FR_NO_FILE) {        /* Can create a new directory */
       dcl = create_chain(dj.fs, 0);    /* Allocate a cluster for the new directory table */
       res = FR_OK;
@@ -3313,6 +5750,9 @@ FRESULT f_mkdir (
         ST_CLUST(dir, dcl);          /* Table start cluster */
         dj.fs->wflag = 1;
         res = sync(dj.fs);
+#if _FS_PCACHE
+        if (res == FR_OK) pc_mkdir(&dj, path, dcl, 0);
+#endif
       }
     }
     FREE_BUF();
@@ -3351,6 +5791,13 @@ FRESULT f_chmod (
       dir = dj.dir;
       if (!dir) {            /* Is it a root directory? */
         res = FR_INVALID_NAME;
+#if _FS_EXFAT
+      } else if (dj.fs->fs_type == FS_EXFAT) {  /* Change it in the entry set */
+        mask &= AM_RDO|AM_HID|AM_SYS|AM_ARC;
+        dj.xent[XDIR_Attr] = (value & mask) | (dj.xent[XDIR_Attr] & (BYTE)~mask);
+        res = xdir_store(&dj);
+        if (res == FR_OK) res = sync(dj.fs);
+#endif
       } else {            /* File or sub directory */
         mask &= AM_RDO|AM_HID|AM_SYS|AM_ARC;  /* Valid attribute mask */
         dir[DIR_Attr] = (value & mask) | (dir[DIR_Attr] & (BYTE)~mask);  /* Apply attribute change */
@@ -3392,6 +5839,13 @@ FRESULT f_utime (
       dir = dj.dir;
       if (!dir) {          /* Root directory */
         res = FR_INVALID_NAME;
+#if _FS_EXFAT
+      } else if (dj.fs->fs_type == FS_EXFAT) {  /* Change it in the entry set */
+        ST_WORD(dj.xent+XDIR_ModTime, fno->ftime);
+        ST_WORD(dj.xent+XDIR_ModTime+2, fno->fdate);
+        res = xdir_store(&dj);
+        if (res == FR_OK) res = sync(dj.fs);
+#endif
       } else {          /* File or sub-directory */
         ST_WORD(dir+DIR_WrtTime, fno->ftime);
         ST_WORD(dir+DIR_WrtDate, fno->fdate);
@@ -3438,12 +5892,26 @@ FRESULT f_rename (
         res = FR_NO_FILE;
       } else {
         mem_cpy(buf, djo.dir+DIR_Attr, 21);    /* Save the object information except for name */
+#if _FS_PCACHE
+        if (OBJ_ATTR(&djo) & AM_DIR) pc_drop(djo.fs, 0);  /* Cached paths under the directory are moved */
+#endif
         mem_cpy(&djn, &djo, sizeof(DIR));    /* Check new object */
         res = follow_path(&djn, path_new);
         if (res == FR_OK) res = FR_EXIST;    /* The new object name is already existing */
         if (res == FR_NO_FILE) {         /* Is it a valid path and no name collision? */
 /* Start critical section that any interruption or error can cause cross-link */
           res = dir_register(&djn);      /* Register the new entry */
+#if _FS_EXFAT
+          if (res == FR_OK && djn.fs->fs_type == FS_EXFAT) {  /* Copy object information except for name */
+            mem_cpy(djn.xent+XDIR_Attr, djo.xent+XDIR_Attr, SZ_DIR - XDIR_Attr);
+            djn.xent[XDIR_GenFlags] = djo.xent[XDIR_GenFlags];
+            mem_cpy(djn.xent+XDIR_ValidFileSize, djo.xent+XDIR_ValidFileSize, 24);
+            djn.xent[XDIR_Attr] |= AM_ARC;
+            res = xdir_store(&djn);
+            if (res == FR_OK) res = dir_remove(&djo);  /* Remove old entry */
+            if (res == FR_OK) res = sync(djo.fs);
+          } else
+#endif
           if (res == FR_OK) {
             dir = djn.dir;          /* Copy object information except for name */
             mem_cpy(dir+13, buf+2, 19);
@@ -3498,9 +5966,9 @@ FRESULT f_forward (
 )
 {
   FRESULT res;
-  DWORD remain, clst, sect;
-  UINT rcnt;
-  BYTE csect;
+  DWORD clst, sect;
+  FSIZE_t remain;
+  UINT rcnt, csect;
 
 
   *bf = 0;  /* Initialize byte counter */
@@ -3509,7 +5977,7 @@ FRESULT f_forward (
   if (res != FR_OK) LEAVE_FF(fp->fs, res);
   if (fp->flag & FA__ERROR)            /* Check error flag */
     LEAVE_FF(fp->fs, FR_INT_ERR);
-  if (!(fp->flag & FA_READ))            /* Check access mode */
+  if (!(fp->flag & FA_READ) || (fp->xflag & FX_DIRECT))  /* Check access mode (streams through the window) */
     LEAVE_FF(fp->fs, FR_DENIED);
 
   remain = fp->fsize - fp->fptr;
@@ -3517,11 +5985,11 @@ FRESULT f_forward (
 
   for ( ;  btr && (*func)(0, 0);          /* Repeat until all data transferred or stream becomes busy */
     fp->fptr += rcnt, *bf += rcnt, btr -= rcnt) {
-    csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));  /* Sector offset in the cluster */
+    csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));  /* Sector offset in the cluster */
     if ((fp->fptr % SS(fp->fs)) == 0) {      /* On the sector boundary? */
       if (!csect) {              /* On the cluster boundary? */
         clst = (fp->fptr == 0) ?      /* On the top of the file? */
-          fp->sclust : get_fat(fp->fs, fp->clust);
+          fp->sclust : next_clust(fp, fp->clust);
         if (clst <= 1) ABORT(fp->fs, FR_INT_ERR);
         if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
         fp->clust = clst;          /* Update current cluster */
@@ -3545,6 +6013,101 @@ FRESULT f_forward (
 
 
 
+
+#if _USE_STREAM
+/*-----------------------------------------------------------------------*/
+/* Stream data to another core directly from the card                    */
+/*-----------------------------------------------------------------------*/
+/* The sectors go to a streaming channel as 128 words each (see          */
+/* disk_read_chan()) with one multiple block read per run of contiguous  */
+/* clusters. The file pointer and btr have to be on sector boundaries,   */
+/* but btr may run to the end of the file, whose last sector is sent     */
+/* whole.                                                                */
+
+FRESULT f_stream (
+  FIL *fp,      /* Pointer to the file object */
+  DISKCHAN c,      /* Streaming channel end to the consumer */
+  UINT btr,      /* Number of bytes to stream */
+  UINT *bs      /* Pointer to number of bytes streamed */
+)
+{
+  FRESULT res;
+  DWORD clst, sect;
+  FSIZE_t remain;
+  UINT rcnt, cc, csect, n;
+
+
+  *bs = 0;  /* Initialize byte counter */
+
+  res = validate(fp->fs, fp->id);          /* Check validity of the object */
+  if (res != FR_OK) LEAVE_FF(fp->fs, res);
+  if (fp->flag & FA__ERROR)            /* Check error flag */
+    LEAVE_FF(fp->fs, FR_INT_ERR);
+  if (!(fp->flag & FA_READ))            /* Check access mode */
+    LEAVE_FF(fp->fs, FR_DENIED);
+  remain = fp->fsize - fp->fptr;
+  if (remain && ((UINT)fp->fptr % SS(fp->fs)    /* Whole sectors only, but for the last sector of the file */
+    || (btr < remain && btr % SS(fp->fs))))
+    LEAVE_FF(fp->fs, FR_INVALID_PARAMETER);
+  if (btr > remain) btr = (UINT)remain;      /* Truncate btr by remaining bytes */
+
+#if !_FS_READONLY
+#if _FS_TINY
+  if (move_window(fp->fs, 0))          /* The card has to see the dirty sector cache first */
+    ABORT(fp->fs, FR_DISK_ERR);
+#else
+  if (fp->flag & FA__DIRTY) {
+    if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+      ABORT(fp->fs, FR_DISK_ERR);
+    fp->flag &= ~FA__DIRTY;
+  }
+#endif
+#endif
+
+  for ( ;  btr;                /* Repeat until all data streamed */
+    fp->fptr += rcnt, *bs += rcnt, btr -= rcnt) {
+    csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));  /* Sector offset in the cluster */
+    if (!csect) {              /* On the cluster boundary? */
+      if (fp->fptr == 0) {        /* On the top of the file? */
+        clst = fp->sclust;
+      } else {
+#if _USE_FASTSEEK
+        if (fp->cltbl)
+          clst = clmt_clust(fp, fp->fptr);
+        else
+#endif
+          clst = next_clust(fp, fp->clust);
+      }
+      if (clst < 2) ABORT(fp->fs, FR_INT_ERR);
+      if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+      fp->clust = clst;          /* Update current cluster */
+    }
+    sect = clust2sect(fp->fs, fp->clust);    /* Get current data sector */
+    if (!sect) ABORT(fp->fs, FR_INT_ERR);
+    sect += csect;
+    n = (btr + SS(fp->fs) - 1) / SS(fp->fs);  /* Sectors left to stream */
+    cc = fp->fs->csize - csect;        /* Sectors left in this cluster */
+    while (cc < n && cc + fp->fs->csize <= 128) {  /* Extend the read over the following contiguous clusters */
+      clst = next_clust(fp, fp->clust);
+      if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+      if (clst != fp->clust + 1) break;
+      fp->clust = clst;
+      cc += fp->fs->csize;
+    }
+    if (cc > 128) cc = 128;          /* Clip at the sector count of a disk_read_chan() */
+    if (cc > n) cc = n;
+    if (disk_read_chan(fp->fs->drv, c, sect, (BYTE)cc) != RES_OK)
+      ABORT(fp->fs, FR_DISK_ERR);
+    rcnt = SS(fp->fs) * cc;          /* Number of bytes streamed */
+    if (rcnt > btr) rcnt = btr;        /* End of file in the last sector */
+  }
+
+  LEAVE_FF(fp->fs, FR_OK);
+}
+#endif /* _USE_STREAM */
+
+
+
 #if _USE_MKFS && !_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Create File System on the Drive                                       */
@@ -3552,10 +6115,15 @@ FRESULT f_forward (
 #define N_ROOTDIR  512    /* Number of root dir entries for FAT12/16 */
 #define N_FATS    1    /* Number of FAT copies (1 or 2) */
 
+/* With sfd = 2 the volume is laid out for SD memory cards: the partition  */
+/* starts and the data area starts on an erase block (allocation unit)     */
+/* boundary of the card, the FAT area fills up the space in front of the   */
+/* data area and the cluster size is chosen by the card capacity (8KB up   */
+/* to 8MB, 16KB up to 1GB, 32KB above) unless au is given.                 */
 
 FRESULT f_mkfs (
   BYTE drv,    /* Logical drive number */
-  BYTE sfd,    /* Partitioning rule 0:FDISK, 1:SFD */
+  BYTE sfd,    /* Partitioning rule 0:FDISK, 1:SFD, 2:FDISK aligned to the SD erase blocks */
   UINT au      /* Allocation unit size [bytes] */
 )
 {
@@ -3566,13 +6134,14 @@ FRESULT f_mkfs (
   UINT i;
   DWORD b_vol, b_fat, b_dir, b_data;  /* LBA */
   DWORD n_vol, n_rsv, n_fat, n_dir;  /* Size */
+  DWORD eb;              /* Erase block size */
   FATFS *fs;
   DSTATUS stat;
 
 
   /* Check mounted drive and clear work area */
   if (drv >= _VOLUMES) return FR_INVALID_DRIVE;
-  if (sfd > 1) return FR_INVALID_PARAMETER;
+  if (sfd > 2) return FR_INVALID_PARAMETER;
   if (au & (au - 1)) return FR_INVALID_PARAMETER;
   fs = FatFs[drv];
   if (!fs) return FR_NOT_ENABLED;
@@ -3585,9 +6154,11 @@ FRESULT f_mkfs (
   if (stat & STA_NOINIT) return FR_NOT_READY;
   if (stat & STA_PROTECT) return FR_WRITE_PROTECTED;
 #if _MAX_SS != 512          /* Get disk sector size */
-  if (disk_ioctl(pdrv, GET_SECTOR_SIZE, &SS(fs)) != RES_OK || SS(fs) > _MAX_SS)
+  if (disk_ioctl(pdrv, GET_SECTOR_SIZE, (BYTE*)&SS(fs)) != RES_OK || SS(fs) > _MAX_SS)
     return FR_DISK_ERR;
 #endif
+  if (disk_ioctl(pdrv, GET_BLOCK_SIZE, (BYTE*)&eb) != RES_OK || !eb || eb > ((sfd == 2) ? 131072 : 32768))
+    eb = 1;    /* Get erase block size (no alignment if unknown) */
   if (_MULTI_PARTITION && part) {
     /* Get partition information from partition table in the MBR */
     if (disk_read(pdrv, fs->win, 0, 1) != RES_OK) return FR_DISK_ERR;
@@ -3598,16 +6169,23 @@ FRESULT f_mkfs (
     n_vol = LD_DWORD(tbl+12);  /* Volume size */
   } else {
     /* Create a partition in this function */
-    if (disk_ioctl(pdrv, GET_SECTOR_COUNT, &n_vol) != RES_OK || n_vol < 128)
+    if (disk_ioctl(pdrv, GET_SECTOR_COUNT, (BYTE*)&n_vol) != RES_OK || n_vol < 128)
       return FR_DISK_ERR;
-    b_vol = (sfd) ? 0 : 63;    /* Volume start sector */
+    b_vol = (sfd == 1) ? 0 : 63;  /* Volume start sector */
+    if (sfd == 2)          /* Start the volume on an erase block boundary */
+      b_vol = (b_vol + eb - 1) / eb * eb;
+    if (n_vol < b_vol + 128) return FR_MKFS_ABORTED;
     n_vol -= b_vol;        /* Volume size */
   }
 
   if (!au) {        /* AU auto selection */
-    vs = n_vol / (2000 / (SS(fs) / 512));
-    for (i = 0; vs < vst[i]; i++) ;
-    au = cst[i];
+    if (sfd == 2) {      /* By the card capacity */
+      au = (n_vol <= 16384) ? 8192 : (n_vol <= 2097152) ? 16384 : 32768;
+    } else {
+      vs = n_vol / (2000 / (SS(fs) / 512));
+      for (i = 0; vs < vst[i]; i++) ;
+      au = cst[i];
+    }
   }
   au /= SS(fs);    /* Number of sectors per cluster */
   if (au == 0) au = 1;
@@ -3636,10 +6214,13 @@ FRESULT f_mkfs (
   if (n_vol < b_data + au - b_vol) return FR_MKFS_ABORTED;  /* Too small volume */
 
   /* Align data start sector to erase block boundary (for flash memory media) */
-  if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &n) != RES_OK || !n || n > 32768) n = 1;
-  n = (b_data + n - 1) & ~(n - 1);  /* Next nearest erase block from current data start */
-  n = (n - b_data) / N_FATS;
-  if (fmt == FS_FAT32) {    /* FAT32: Move FAT offset */
+  for (;;) {
+    n = (b_data + eb - 1) / eb * eb;  /* Next nearest erase block from current data start */
+    n = (n - b_data) / N_FATS;
+    if (fmt == FS_FAT32 || n_fat + n <= 0xFFFF || eb == 1) break;
+    eb /= 2;        /* BPB_FATSz16 is a WORD, align to a part of the erase block */
+  }
+  if (fmt == FS_FAT32 && n_rsv + n <= 0xFFFF) {  /* FAT32: Move FAT offset */
     n_rsv += n;
     b_fat += n;
   } else {          /* FAT12/16: Expand FAT size */
@@ -3651,6 +6232,7 @@ FRESULT f_mkfs (
   if (   (fmt == FS_FAT16 && n_clst < MIN_FAT16)
     || (fmt == FS_FAT32 && n_clst < MIN_FAT32))
     return FR_MKFS_ABORTED;
+  if (!FAT_ENABLED(fmt)) return FR_MKFS_ABORTED;  /* The FAT type is not built in */
 
   switch (fmt) {  /* Determine system ID for partition table */
   case FS_FAT12:  sys = 0x01; break;
@@ -3665,20 +6247,21 @@ FRESULT f_mkfs (
     if (disk_write(pdrv, fs->win, 0, 1) != RES_OK) return FR_DISK_ERR;
     md = 0xF8;
   } else {
-    if (sfd) {  /* No patition table (SFD) */
+    if (sfd == 1) {  /* No patition table (SFD) */
       md = 0xF0;
     } else {  /* Create partition table (FDISK) */
       mem_set(fs->win, 0, SS(fs));
       tbl = fs->win+MBR_Table;  /* Create partiton table for single partition in the drive */
-      tbl[1] = 1;            /* Partition start head */
-      tbl[2] = 1;            /* Partition start sector */
-      tbl[3] = 0;            /* Partition start cylinder */
+      n = b_vol / 63 / 255;
+      tbl[1] = (BYTE)(b_vol / 63 % 255);  /* Partition start head */
+      tbl[2] = (BYTE)((b_vol % 63 + 1) | ((n >> 2) & 0xC0));  /* Partition start sector */
+      tbl[3] = (BYTE)n;        /* Partition start cylinder */
       tbl[4] = sys;          /* System type */
       tbl[5] = 254;          /* Partition end head */
       n = (b_vol + n_vol) / 63 / 255;
       tbl[6] = (BYTE)((n >> 2) | 63);  /* Partiiton end sector */
       tbl[7] = (BYTE)n;        /* End cylinder */
-      ST_DWORD(tbl+8, 63);      /* Partition start in LBA */
+      ST_DWORD(tbl+8, b_vol);      /* Partition start in LBA */
       ST_DWORD(tbl+12, n_vol);    /* Partition size in LBA */
       ST_WORD(fs->win+BS_55AA, 0xAA55);  /* MBR signature */
       if (disk_write(pdrv, fs->win, 0, 1) != RES_OK)  /* Write it to the MBR sector */
@@ -3762,10 +6345,10 @@ FRESULT f_mkfs (
 
 #if _USE_ERASE  /* Erase data area if needed */
   {
-    DWORD eb[2];
+    DWORD rgn[2];
 
-    eb[0] = wsect; eb[1] = wsect + (n_clst - ((fmt == FS_FAT32) ? 1 : 0)) * au - 1;
-    disk_ioctl(pdrv, CTRL_ERASE_SECTOR, eb);
+    rgn[0] = wsect; rgn[1] = wsect + (n_clst - ((fmt == FS_FAT32) ? 1 : 0)) * au - 1;
+    disk_ioctl(pdrv, CTRL_ERASE_SECTOR, (BYTE*)rgn);
   }
 #endif
 
@@ -23,6 +23,9 @@ extern "C" {
 
 #include "integer.h"  /* Basic integer types */
 #include "ffconf.h"     /* FatFs configuration options */
+#if _USE_STREAM
+#include "diskio.h"     /* Streaming channel end type (DISKCHAN) */
+#endif
 
 #if _FATFS != _FFCONF
 #error Wrong configuration file (ffconf.h).
@@ -72,16 +75,44 @@ typedef char TCHAR;
 
 
 
+/* Type of file size and file pointer */
+
+#if _FS_EXFAT
+typedef QWORD FSIZE_t;
+#else
+typedef DWORD FSIZE_t;
+#endif
+
+
+
+#if _FS_PCACHE
+/* Path cache entry structure (PCENT) */
+
+typedef struct {
+  WORD  id;        /* Mount ID of the volume when cached (0:Empty) */
+  WORD  len;      /* Length of the path */
+  DWORD  base;      /* Directory the path starts from (0:Root dir) */
+  DWORD  sclust;      /* Table start cluster of the directory (0:Root dir) */
+#if _FS_EXFAT
+  DWORD  ncl;      /* exFAT: Clusters of a contiguous table (0:FAT chain) */
+#endif
+  DWORD  used;      /* Stamp of the last use */
+  TCHAR  path[_PCACHE_LEN];  /* Path of the directory */
+} PCENT;
+#endif
+
+
+
 /* File system object structure (FATFS) */
 
 typedef struct {
   BYTE  fs_type;    /* FAT sub-type (0:Not mounted) */
   BYTE  drv;      /* Physical drive number */
-  BYTE  csize;      /* Sectors per cluster (1,2,4...128) */
   BYTE  n_fats;      /* Number of FAT copies (1,2) */
   BYTE  wflag;      /* win[] dirty flag (1:must be written back) */
   BYTE  fsi_flag;    /* fsinfo dirty flag (1:must be written back) */
   WORD  id;        /* File system mount ID */
+  WORD  csize;      /* Sectors per cluster (1,2,4...128, exFAT up to 32768) */
   WORD  n_rootdir;    /* Number of root directory entries (FAT12/16) */
 #if _MAX_SS != 512
   WORD  ssize;      /* Bytes per sector (512, 1024, 2048 or 4096) */
@@ -93,6 +124,11 @@ typedef struct {
   DWORD  last_clust;    /* Last allocated cluster */
   DWORD  free_clust;    /* Number of free clusters */
   DWORD  fsi_sector;    /* fsinfo sector (FAT32) */
+#if _FS_AUALLOC
+  DWORD  au_clust;    /* Clusters per erase block (0:not aligned allocation) */
+  DWORD  au_ofs;      /* Clusters of the erase block in front of cluster 2 */
+  DWORD  au_next;    /* Erase block to be checked first for a new file region */
+#endif
 #endif
 #if _FS_RPATH
   DWORD  cdir;      /* Current directory start cluster (0:root) */
@@ -102,6 +138,19 @@ typedef struct {
   DWORD  fatbase;    /* FAT start sector */
   DWORD  dirbase;    /* Root directory start sector (FAT32:Cluster#) */
   DWORD  database;    /* Data start sector */
+#if _FS_EXFAT
+  DWORD  bitbase;    /* Allocation bitmap start sector (exFAT) */
+#endif
+#if _USE_READDIRS
+  BYTE*  dblk;      /* Directory read buffer of f_readdirs (0:Not in use) */
+  UINT  dbsize;      /* Size of the directory read buffer in sectors */
+  DWORD  dbsect;    /* First sector in the directory read buffer */
+  UINT  dbcnt;      /* Sectors in the directory read buffer */
+#endif
+#if _FS_PCACHE
+  DWORD  pcstamp;    /* Stamp of the last path cache use */
+  PCENT  pcache[_FS_PCACHE];  /* Path cache */
+#endif
   DWORD  winsect;    /* Current sector appearing in the win[] */
   BYTE  win[_MAX_SS];  /* Disk access window for Directory, FAT (and Data on tiny cfg) */
 } FATFS;
@@ -114,9 +163,9 @@ typedef struct {
   FATFS*  fs;        /* Pointer to the owner file system object */
   WORD  id;        /* Owner file system mount ID */
   BYTE  flag;      /* File status flags */
-  BYTE  pad1;
-  DWORD  fptr;      /* File read/write pointer (0 on file open) */
-  DWORD  fsize;      /* File size */
+  BYTE  xflag;      /* Extended file status flags (FX_DIRECT) */
+  FSIZE_t  fptr;      /* File read/write pointer (0 on file open) */
+  FSIZE_t  fsize;      /* File size */
   DWORD  sclust;      /* File start cluster (0 when fsize==0) */
   DWORD  clust;      /* Current cluster */
   DWORD  dsect;      /* Current data sector */
@@ -124,6 +173,14 @@ typedef struct {
   DWORD  dir_sect;    /* Sector containing the directory entry */
   BYTE*  dir_ptr;    /* Ponter to the directory entry in the window */
 #endif
+#if _FS_EXFAT
+  BYTE  stat;      /* exFAT: File allocation (0:FAT chain, 2:Contiguous) */
+#if !_FS_READONLY
+  WORD  dir_idx;    /* exFAT: Index of the file entry in the directory */
+  DWORD  dir_sclust;    /* exFAT: Directory start cluster (0:Root dir) */
+  DWORD  dir_ncl;    /* exFAT: Clusters of a contiguous directory (0:FAT chain) */
+#endif
+#endif
 #if _USE_FASTSEEK
   DWORD*  cltbl;      /* Pointer to the cluster link map table (null on file open) */
 #endif
@@ -152,6 +209,10 @@ typedef struct {
   WCHAR*  lfn;      /* Pointer to the LFN working buffer */
   WORD  lfn_idx;    /* Last matched LFN index number (0xFFFF:No LFN) */
 #endif
+#if _FS_EXFAT
+  DWORD  ncl;      /* exFAT: Clusters of a contiguous table (0:FAT chain) */
+  BYTE  xent[64];    /* exFAT: File and stream entries of the found object */
+#endif
 } DIR;
 
 
@@ -159,7 +220,7 @@ typedef struct {
 /* File status structure (FILINFO) */
 
 typedef struct {
-  DWORD  fsize;      /* File size */
+  FSIZE_t  fsize;      /* File size */
   WORD  fdate;      /* Last modified date */
   WORD  ftime;      /* Last modified time */
   BYTE  fattrib;    /* Attribute */
@@ -172,6 +233,65 @@ typedef struct {
 
 
 
+#if _USE_READDIRS
+/* Directory item structure (DIRITEM) */
+
+typedef struct {
+  FSIZE_t  fsize;      /* File size */
+  DWORD  sclust;      /* Start cluster (0:No data) */
+  BYTE  fattrib;    /* Attribute */
+  TCHAR  fname[13];    /* Short file name (8.3 format), as in FILINFO */
+#if _USE_LFN
+  TCHAR*  lfname;      /* Pointer to the LFN buffer of this item (0:No LFN) */
+  UINT   lfsize;      /* Size of LFN buffer in TCHAR */
+#endif
+} DIRITEM;
+#endif
+
+
+
+#if _USE_FRAGSTAT
+/* Fragmentation statistics structure (FRAGSTAT) */
+
+typedef struct {
+  DWORD  n_clust;    /* Number of clusters of the volume */
+  DWORD  clsize;      /* Cluster size in bytes */
+  DWORD  files;      /* Files walked */
+  DWORD  dirs;      /* Directories walked */
+  DWORD  skipped;    /* Directories not entered (too deep) */
+  DWORD  fragmented;    /* Files of more than one extent */
+  DWORD  extents;    /* Extents of all files */
+  DWORD  max_extents;  /* Most extents of a file */
+  DWORD  ext_hist[8];  /* Files of 1, 2, 3-4, 5-8, .. 33-64, 65- extents */
+  DWORD  free_clust;    /* Free clusters */
+  DWORD  free_runs;    /* Runs of free clusters */
+  DWORD  max_run;    /* Largest contiguous free region in clusters */
+  DWORD  max_run_clust;  /* First cluster of the largest free region */
+  DWORD  run_hist[16];  /* Free runs of 1, 2-3, 4-7, .. 16384-32767, 32768- clusters */
+} FRAGSTAT;
+#endif
+
+
+
+#if _USE_DEFRAG
+/* Defragmenter object structure (DEFRAG) */
+
+typedef struct {
+  FIL*  fp;        /* File being defragmented */
+  BYTE*  buf;      /* Copy buffer */
+  UINT  nsect;      /* Size of the copy buffer in sectors */
+  FSIZE_t  fsize;      /* File size when started */
+  DWORD  ncl;      /* Number of clusters to be copied (0:Nothing to do) */
+  DWORD  dcl;      /* First cluster of the contiguous block */
+  DWORD  scl;      /* Source cluster being copied */
+  DWORD  done;      /* Number of clusters copied */
+  UINT  ofs;      /* Sectors of the source cluster copied */
+  DWORD  frag;      /* Number of fragments of the file */
+} DEFRAG;
+#endif
+
+
+
 /* File function return code (FRESULT) */
 
 typedef enum {
@@ -205,14 +325,25 @@ typedef enum {
 FRESULT f_mount (BYTE, FATFS*);            /* Mount/Unmount a logical drive */
 FRESULT f_open (FIL*, const TCHAR*, BYTE);      /* Open or create a file */
 FRESULT f_read (FIL*, void*, UINT, UINT*);      /* Read data from a file */
-FRESULT f_lseek (FIL*, DWORD);            /* Move file pointer of a file object */
+FRESULT f_lseek (FIL*, FSIZE_t);            /* Move file pointer of a file object */
 FRESULT f_close (FIL*);                /* Close an open file object */
 FRESULT f_opendir (DIR*, const TCHAR*);        /* Open an existing directory */
 FRESULT f_readdir (DIR*, FILINFO*);          /* Read a directory item */
+#if _USE_READDIRS
+FRESULT f_readdirs (DIR*, DIRITEM*, UINT, UINT*, void*, UINT, const TCHAR*, BYTE);  /* Read directory items in bulk */
+#endif
+#if _USE_FRAGSTAT
+FRESULT f_fragstat (const TCHAR*, FRAGSTAT*, void*, UINT, void(*)(const TCHAR*, FSIZE_t, DWORD));  /* Get fragmentation statistics */
+#endif
 FRESULT f_stat (const TCHAR*, FILINFO*);      /* Get file status */
 FRESULT f_write (FIL*, const void*, UINT, UINT*);  /* Write data to a file */
 FRESULT f_getfree (const TCHAR*, DWORD*, FATFS**);  /* Get number of free clusters on the drive */
 FRESULT f_truncate (FIL*);              /* Truncate file */
+FRESULT f_expand (FIL*, FSIZE_t, BYTE);        /* Allocate a contiguous block to the file */
+#if _USE_DEFRAG
+FRESULT f_defrag (DEFRAG*, FIL*, void*, UINT);    /* Start defragmenting a file */
+FRESULT f_defrag_step (DEFRAG*, DWORD*);      /* Copy a part of the file to its new block */
+#endif
 FRESULT f_sync (FIL*);                /* Flush cached data of a writing file */
 FRESULT f_unlink (const TCHAR*);          /* Delete an existing file or directory */
 FRESULT  f_mkdir (const TCHAR*);            /* Create a new directory */
@@ -223,6 +354,9 @@ FRESULT f_chdrive (BYTE);              /* Change current drive */
 FRESULT f_chdir (const TCHAR*);            /* Change current directory */
 FRESULT f_getcwd (TCHAR*, UINT);          /* Get current directory */
 FRESULT f_forward (FIL*, UINT(*)(const BYTE*,UINT), UINT, UINT*);  /* Forward data to the stream */
+#if _USE_STREAM
+FRESULT f_stream (FIL*, DISKCHAN, UINT, UINT*);      /* Stream data to another core */
+#endif
 FRESULT f_mkfs (BYTE, BYTE, UINT);          /* Create a file system on the drive */
 FRESULT  f_fdisk (BYTE, const DWORD[], void*);    /* Divide a physical drive into some partitions */
 int f_putc (TCHAR, FIL*);              /* Put a character to the file */
@@ -279,6 +413,7 @@ int ff_del_syncobj (_SYNC_t);    /* Delete a sync object */
 
 #define  FA_READ        0x01
 #define  FA_OPEN_EXISTING  0x00
+#define  FA_DIRECT      0x20
 #define FA__ERROR      0x80
 
 #if !_FS_READONLY
@@ -291,11 +426,17 @@ int ff_del_syncobj (_SYNC_t);    /* Delete a sync object */
 #endif
 
 
+/* Extended file status flags (FIL.xflag) */
+
+#define FX_DIRECT      0x01  /* Opened with FA_DIRECT: data bypasses the sector buffer */
+
+
 /* FAT sub type (FATFS.fs_type) */
 
 #define FS_FAT12  1
 #define FS_FAT16  2
 #define FS_FAT32  3
+#define FS_EXFAT  4
 
 
 /* File attribute bits for directory entry */
@@ -330,6 +471,11 @@ int ff_del_syncobj (_SYNC_t);    /* Delete a sync object */
 #define  ST_DWORD(ptr,val)  *(BYTE*)(ptr)=(BYTE)(val); *((BYTE*)(ptr)+1)=(BYTE)((WORD)(val)>>8); *((BYTE*)(ptr)+2)=(BYTE)((DWORD)(val)>>16); *((BYTE*)(ptr)+3)=(BYTE)((DWORD)(val)>>24)
 #endif
 
+#if _FS_EXFAT
+#define  LD_QWORD(ptr)    (QWORD)(((QWORD)LD_DWORD((BYTE*)(ptr)+4)<<32)|LD_DWORD(ptr))
+#define  ST_QWORD(ptr,val)  ST_DWORD(ptr,(DWORD)(val)); ST_DWORD((BYTE*)(ptr)+4,(DWORD)((QWORD)(val)>>32))
+#endif
+
 #ifdef __cplusplus
 }
 #endif
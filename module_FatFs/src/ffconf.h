@@ -40,7 +40,7 @@
 /* To enable string functions, set _USE_STRFUNC to 1 or 2. */
 
 
-#define	_USE_MKFS       0	/* 0:Disable or 1:Enable */
+#define	_USE_MKFS       1	/* 0:Disable or 1:Enable */
 /* To enable f_mkfs function, set _USE_MKFS to 1 and set _FS_READONLY to 0 */
 
 
@@ -48,10 +48,79 @@
 /* To enable f_forward function, set _USE_FORWARD to 1 and set _FS_TINY to 1. */
 
 
+#define	_USE_EXPAND	0	/* 0:Disable or 1:Enable */
+/* To enable f_expand function, set _USE_EXPAND to 1. f_expand allocates a
+/  contiguous block of clusters to an empty file, so it can be written with
+/  plain multiple block writes afterwards. */
+
+
+#define	_USE_READDIRS	0	/* 0:Disable or 1:Enable */
+/* To enable f_readdirs function, set _USE_READDIRS to 1. f_readdirs reads a
+/  batch of directory items per call with multiple block reads of the
+/  directory cluster. It needs _FS_MINIMIZE <= 1. With _USE_LFN, the long
+/  names are returned in the lfname buffers of the items. */
+
+
+#define	_USE_FRAGSTAT	0	/* 0:Disable or 1:Enable */
+/* To enable f_fragstat function, set _USE_FRAGSTAT to 1. f_fragstat walks the
+/  directory tree and the FAT and reports the extents of the files and the
+/  runs of free clusters. It needs _FS_MINIMIZE <= 1. */
+
+
+#define	_USE_DEFRAG	0	/* 0:Disable or 1:Enable */
+/* To enable f_defrag function and the idle time defragmenter (defrag.c), set
+/  _USE_DEFRAG to 1. f_defrag copies a fragmented file to a contiguous block
+/  a part at a time and switches its directory entry to the block at the end. */
+
+
+#define	_USE_STREAM	0	/* 0:Disable or 1:Enable */
+/* To enable f_stream function, set _USE_STREAM to 1. f_stream sends file
+/  data from the card straight into a streaming channel to another core, with
+/  one multiple block read per run of contiguous clusters. */
+
+
+#define	_USE_RINGLOG	0	/* 0:Disable or 1:Enable */
+/* To enable the ring log file (ringlog.c), set _USE_RINGLOG to 1. A ring log
+/  is a preallocated file used as a circular buffer of sectors, appending to
+/  it never updates the FAT or the directory. It needs _USE_EXPAND. */
+
+
 #define	_USE_FASTSEEK	0	/* 0:Disable or 1:Enable */
 /* To enable fast seek feature, set _USE_FASTSEEK to 1. */
 
 
+#define	_FS_AUALLOC	0	/* 0:Disable or 1:Enable */
+/* When _FS_AUALLOC is set to 1, files are allocated in the erase blocks
+/  (allocation units) of the card reported by GET_BLOCK_SIZE. A file grows
+/  contiguously from its last cluster and takes a new, completely free AU
+/  when it is created or runs into a used one, so files written at the same
+/  time do not interleave. */
+
+
+
+/*---------------------------------------------------------------------------/
+/ Pipeline Configurations
+/----------------------------------------------------------------------------*/
+
+#define	_USE_RECORDER	0	/* 0:Disable or 1:Enable */
+/* To enable the recording pipeline (recorder.c), set _USE_RECORDER to 1.
+/  A producer core queues filled buffers without blocking and a writer core
+/  writes them to a preallocated file. It needs _USE_EXPAND. */
+
+
+#define	_USE_PLAYER	0	/* 0:Disable or 1:Enable */
+/* To enable the playback pipeline (player.c), set _USE_PLAYER to 1. A reader
+/  core keeps a pool of buffers filled ahead of a consumer core, which gets
+/  and releases them without waiting for the card. */
+
+
+#define	_USE_COMPLOG	0	/* 0:Disable or 1:Enable */
+/* To enable the compressed log (complog.c), set _USE_COMPLOG to 1. A producer
+/  core queues filled buffers without blocking, a compressor core turns them
+/  into blocks of the LZ4 block format and a writer core appends the blocks
+/  to the file. */
+
+
 
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
@@ -110,6 +179,21 @@
 /  enable LFN feature and set _LFN_UNICODE to 1. */
 
 
+#define	_FS_FAT12	1	/* 0:Disable or 1:Enable */
+#define	_FS_FAT16	1	/* 0:Disable or 1:Enable */
+#define	_FS_FAT32	1	/* 0:Disable or 1:Enable */
+/* The FAT types that can be mounted and created by f_mkfs. The code of the
+/  disabled types is left out, and with only one type enabled the FAT access
+/  needs no run-time type switch. SD cards up to 2GB are FAT12/16, SDHC cards
+/  are FAT32. Volumes of a disabled type are rejected with FR_NO_FILESYSTEM. */
+
+
+#define	_FS_EXFAT	0	/* 0:Disable or 1:Enable */
+/* To mount exFAT volumes (SDXC cards), set _FS_EXFAT to 1. File size and
+/  file pointer become 64-bit (FSIZE_t) so files can exceed 4GB. exFAT needs
+/  the LFN feature and cannot be used with _FS_RPATH or _USE_FASTSEEK. */
+
+
 #define _FS_RPATH	0	/* 0 to 2 */
 /* The _FS_RPATH option configures relative path feature.
 /
@@ -126,7 +210,9 @@
 /----------------------------------------------------------------------------*/
 
 #define _VOLUMES	1
-/* Number of volumes (logical drives) to be used. */
+/* Number of volumes (logical drives) to be used. Without _MULTI_PARTITION
+/  volume N is the card on SD host interface N, so _VOLUMES must not exceed
+/  _DRIVES of diskio.h. */
 
 
 #define	_MAX_SS		512		/* 512, 1024, 2048 or 4096 */
@@ -143,7 +229,7 @@
 / is tied to the partitions listed in VolToPart[]. */
 
 
-#define	_USE_ERASE	0	/* 0:Disable or 1:Enable */
+#define	_USE_ERASE	1	/* 0:Disable or 1:Enable */
 /* To enable sector erase feature, set _USE_ERASE to 1. CTRL_ERASE_SECTOR command
 /  should be added to the disk_ioctl functio. */
 
@@ -172,19 +258,38 @@
 
 #define _FS_REENTRANT	        0	/* 0:Disable or 1:Enable */
 #define _FS_TIMEOUT		1000	/* Timeout period in unit of time ticks */
-#define	_SYNC_t			HANDLE	/* O/S dependent type of sync object. e.g. HANDLE, OS_EVENT*, ID and etc.. */
+#define	_SYNC_t			unsigned	/* O/S dependent type of sync object. e.g. HANDLE, OS_EVENT*, ID and etc.. */
 
 /* The _FS_REENTRANT option switches the reentrancy (thread safe) of the FatFs module.
 /
 /   0: Disable reentrancy. _SYNC_t and _FS_TIMEOUT have no effect.
 /   1: Enable reentrancy. Also user provided synchronization handlers,
 /      ff_req_grant, ff_rel_grant, ff_del_syncobj and ff_cre_syncobj
-/      function must be added to the project. */
+/      function must be added to the project.
+/
+/  The handlers in syscall.c lock each volume with an xCORE hardware lock
+/  (_SYNC_t is the lock resource ID), so cores on one tile can use different
+/  volumes at the same time. Hardware locks do not time out (_FS_TIMEOUT is
+/  not used). One lock is taken per mounted volume, plus one for the file
+/  lock table when _FS_SHARE is enabled with more than one volume. A tile has
+/  4 hardware locks, so leave room for the ones the application and the disk
+/  servers take, or f_mount returns FR_INT_ERR. */
 
 
 #define	_FS_SHARE	0	/* 0:Disable or >=1:Enable */
 /* To enable file shareing feature, set _FS_SHARE to 1 or greater. The value
-   defines how many files can be opened simultaneously. */
+   defines how many files can be opened simultaneously. With _FS_REENTRANT
+   it keeps the cores from opening a file that another one is writing. */
+
+
+#define	_FS_PCACHE	0	/* 0:Disable or >=1:Enable */
+#define	_PCACHE_LEN	32	/* Longest cached directory path in TCHAR */
+/* To enable the path cache, set _FS_PCACHE to 1 or greater. The value defines
+   how many directories of each volume are remembered by their path, so that
+   a path in a cached directory is followed from there instead of from the
+   root. Each entry takes _PCACHE_LEN characters plus 16 bytes in the FATFS
+   object. The cache is void when the volume is remounted and is updated by
+   f_mkdir, f_unlink and f_rename. */
 
 
 #endif /* _FFCONFIG */
@@ -0,0 +1,51 @@
+/*-----------------------------------------------------------------------*/
+/* Fragmentation report file on top of FatFs                             */
+/*-----------------------------------------------------------------------*/
+/* The report is written after f_fragstat() has returned, so the walk    */
+/* does not see the report file.                                         */
+/*-----------------------------------------------------------------------*/
+
+#include "fragrep.h"
+
+#if _USE_FRAGSTAT
+
+#if _FS_READONLY
+#error The fragmentation report needs a writable file system.
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write the statistics to a report file                                 */
+/*-----------------------------------------------------------------------*/
+/* An existing file is overwritten.                                      */
+
+FRESULT frag_report (
+  const FRAGSTAT *st,  /* Statistics got by f_fragstat() */
+  const TCHAR *path  /* File name of the report */
+)
+{
+  FRESULT res, res2;
+  FIL file;
+  BYTE buf[FRAG_REPORT];
+  const DWORD *p = (const DWORD*)st;
+  UINT i, bw;
+
+
+  ST_DWORD(buf+FG_MAGIC, FRAG_MAGIC);
+  ST_WORD(buf+FG_VER, 1);
+  ST_WORD(buf+FG_NWORD, FRAG_NWORD);
+  for (i = 0; i < FRAG_NWORD; i++) {
+    ST_DWORD(buf + FG_DATA + i * 4, p[i]);
+  }
+
+  res = f_open(&file, path, FA_WRITE | FA_CREATE_ALWAYS);
+  if (res != FR_OK) return res;
+  res = f_write(&file, buf, sizeof buf, &bw);
+  if (res == FR_OK && bw != sizeof buf) res = FR_DENIED;  /* Volume full */
+  res2 = f_close(&file);
+
+  return res != FR_OK ? res : res2;
+}
+
+#endif /* _USE_FRAGSTAT */
@@ -0,0 +1,29 @@
+/*-----------------------------------------------------------------------
+/  Fragmentation report file on top of FatFs
+/-----------------------------------------------------------------------*/
+/* frag_report() saves the statistics of f_fragstat() in a small binary
+/  file of little-endian words, so that it can be pulled off a device and
+/  decoded on any host. */
+
+#ifndef _FRAGREP
+
+#include "ff.h"
+
+#if _USE_FRAGSTAT
+
+/* Layout of the report file */
+#define FG_MAGIC        0               /* "FRAG" (DWORD) */
+#define FG_VER          4               /* Version of the layout, 1 (WORD) */
+#define FG_NWORD        6               /* Number of DWORDs behind the header (WORD) */
+#define FG_DATA         8               /* The members of FRAGSTAT in order (DWORD each) */
+
+#define FRAG_MAGIC      0x47415246
+#define FRAG_NWORD      (sizeof (FRAGSTAT) / sizeof (DWORD))
+#define FRAG_REPORT     (FG_DATA + FRAG_NWORD * 4)     /* Size of the report file */
+
+FRESULT frag_report (const FRAGSTAT*, const TCHAR*);    /* Write the statistics to a report file */
+
+#endif /* _USE_FRAGSTAT */
+
+#define _FRAGREP
+#endif
@@ -0,0 +1,42 @@
+/*-----------------------------------------------------------------------
+/  xCORE hardware lock functions for the C modules
+/-----------------------------------------------------------------------*/
+/* A hardware lock is a resource of the xCORE tile. Claiming it (IN) pauses
+/  the calling core until the lock is free, releasing it (OUT) lets the
+/  next waiting core in. Locks are only shared by the cores of one tile. */
+
+#ifndef _HWLOCK
+#define _HWLOCK
+
+#define HWLOCK_NONE     0       /* No lock allocated */
+
+/* Allocate a lock (returns HWLOCK_NONE if all locks are in use) */
+static inline unsigned hwlock_alloc (void)
+{
+  unsigned l;
+
+  __asm__ __volatile__ ("getr %0, 5" : "=r"(l));  /* XS1_RES_TYPE_LOCK */
+  return l;
+}
+
+/* Free a lock */
+static inline void hwlock_free (unsigned l)
+{
+  __asm__ __volatile__ ("freer res[%0]" : : "r"(l));
+}
+
+/* Claim a lock, waiting until it is free */
+static inline void hwlock_acquire (unsigned l)
+{
+  unsigned d;
+
+  __asm__ __volatile__ ("in %0, res[%1]" : "=r"(d) : "r"(l) : "memory");
+}
+
+/* Release a lock */
+static inline void hwlock_release (unsigned l)
+{
+  __asm__ __volatile__ ("out res[%0], %0" : : "r"(l) : "memory");
+}
+
+#endif
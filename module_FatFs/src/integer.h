@@ -32,6 +32,9 @@ typedef long			LONG;
 typedef unsigned long	ULONG;
 typedef unsigned long	DWORD;
 
+/* This type must be 64-bit integer */
+typedef unsigned long long	QWORD;
+
 #endif
 
 #endif
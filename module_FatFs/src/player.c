@@ -0,0 +1,250 @@
+/*-----------------------------------------------------------------------*/
+/* Playback pipeline on top of FatFs                                     */
+/*-----------------------------------------------------------------------*/
+/* The pool is a ring of nbuf buffers. The reader fills buffer           */
+/* tail % nbuf with the next bsize bytes of the file, the consumer plays */
+/* buffer head % nbuf. The file is opened with FA_DIRECT, so f_read()    */
+/* transfers each cluster run with one multiple block read straight into */
+/* the buffer. The cluster chain is followed on the reader core only.    */
+/* The doorbell protocol is the one of the disk server and the recorder. */
+/*-----------------------------------------------------------------------*/
+
+#include <string.h>
+#include "player.h"
+#include "diskio.h"
+#include "hwlock.h"
+
+#if _USE_PLAYER
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Fill the next buffer                                                  */
+/*-----------------------------------------------------------------------*/
+
+static
+void ply_fill (
+  PLAYER *p    /* Player object */
+)
+{
+  FRESULT res;
+  UINT br;
+
+
+  res = f_read(&p->file, p->pool + (p->tail % p->nbuf) * p->bsize, p->bsize, &br);
+  p->stat.reads++;
+  if (res != FR_OK) {      /* The playback ends at an error */
+    p->res = res;
+    br = 0;
+  }
+  hwlock_acquire(p->lock);
+  if (br) {
+    p->tail++;
+    p->last = br;
+  }
+  if (br < p->bsize) p->eof = 1;
+  hwlock_release(p->lock);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Open the file and fill the pool                                       */
+/*-----------------------------------------------------------------------*/
+/* The pool is filled before the function returns, so the consumer can  */
+/* start right away.                                                     */
+
+FRESULT ply_open (
+  PLAYER *p,      /* Player object */
+  const TCHAR *path,  /* File to be played */
+  BYTE *pool,      /* Buffer pool of nbuf * bsize bytes, word aligned */
+  UINT nbuf,      /* Number of buffers (2..) */
+  UINT bsize      /* Buffer size in bytes (multiple of 512) */
+)
+{
+  FRESULT res;
+
+
+  if (nbuf < 2 || !bsize || bsize % 512) return FR_INVALID_PARAMETER;
+
+  res = f_open(&p->file, path, FA_READ | FA_DIRECT);
+  if (res != FR_OK) return res;
+  p->lock = hwlock_alloc();
+  if (p->lock == HWLOCK_NONE) {
+    f_close(&p->file);
+    return FR_NOT_ENOUGH_CORE;
+  }
+
+  p->pool = pool;
+  p->nbuf = nbuf;
+  p->bsize = bsize;
+  p->head = p->tail = 0;
+  p->last = 0;
+  p->res = FR_OK;
+  p->eof = 0;
+  p->sleeping = 0;
+  p->stop = 0;
+  memset(&p->stat, 0, sizeof p->stat);
+  p->stat.min_ready = nbuf;
+
+  while (!p->eof && p->tail < nbuf) ply_fill(p);
+
+  return p->res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Register the consumer end of the channel to the reader                */
+/*-----------------------------------------------------------------------*/
+
+void ply_attach (
+  PLAYER *p,    /* Player object */
+  chanend c    /* Consumer end of the channel */
+)
+{
+  p->c = c;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the next filled buffer                                            */
+/*-----------------------------------------------------------------------*/
+/* Returns the oldest buffer not released yet, or 0 without waiting when */
+/* none is filled (an underrun unless the whole file has been played).   */
+
+BYTE* ply_get (
+  PLAYER *p,    /* Player object */
+  UINT *len    /* Pointer to return the number of data bytes */
+)
+{
+  DWORD n;
+  BYTE eof;
+
+
+  hwlock_acquire(p->lock);
+  n = p->tail - p->head;
+  eof = p->eof;
+  hwlock_release(p->lock);
+  if (!eof && n < p->stat.min_ready) p->stat.min_ready = n;
+  if (!n) {
+    if (!eof) p->stat.underruns++;
+    *len = 0;
+    return 0;
+  }
+  *len = (eof && n == 1) ? p->last : p->bsize;
+  return p->pool + (p->head % p->nbuf) * p->bsize;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Hand the buffer got last back to the reader                           */
+/*-----------------------------------------------------------------------*/
+
+void ply_release (
+  PLAYER *p    /* Player object */
+)
+{
+  BYTE s;
+
+
+  hwlock_acquire(p->lock);
+  if (p->head == p->tail) {  /* Nothing to release */
+    hwlock_release(p->lock);
+    return;
+  }
+  p->head++;
+  s = p->sleeping;
+  p->sleeping = 0;
+  hwlock_release(p->lock);
+  p->stat.released++;
+  if (s) disk_chan_signal(p->c);  /* Ring the doorbell */
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Check if the whole file has been played                               */
+/*-----------------------------------------------------------------------*/
+
+int ply_eof (
+  PLAYER *p    /* Player object */
+)
+{
+  int r;
+
+
+  hwlock_acquire(p->lock);
+  r = p->eof && p->head == p->tail;
+  hwlock_release(p->lock);
+  return r;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Finish the playback                                                   */
+/*-----------------------------------------------------------------------*/
+/* Waits until the reader has closed the file.                           */
+
+FRESULT ply_close (
+  PLAYER *p    /* Player object */
+)
+{
+  BYTE s;
+
+
+  hwlock_acquire(p->lock);
+  p->stop = 1;
+  s = p->sleeping;
+  p->sleeping = 0;
+  hwlock_release(p->lock);
+  if (s) disk_chan_signal(p->c);  /* Wake up the reader */
+  disk_chan_wait(p->c);      /* Wait for the file to be closed */
+  hwlock_free(p->lock);
+
+  return p->res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Reader task                                                           */
+/*-----------------------------------------------------------------------*/
+/* Runs on its own core until ply_close() and refills each buffer as     */
+/* soon as it is released.                                               */
+
+FRESULT ply_reader (
+  PLAYER *p,    /* Player object */
+  chanend c    /* Reader end of the channel to the consumer */
+)
+{
+  FRESULT res;
+
+
+  for (;;) {
+    hwlock_acquire(p->lock);
+    if (p->stop) {
+      hwlock_release(p->lock);
+      break;
+    }
+    if (p->eof || p->tail - p->head == p->nbuf) {  /* Nothing to do until a buffer is released */
+      p->sleeping = 1;
+      hwlock_release(p->lock);
+      disk_chan_wait(c);
+      continue;
+    }
+    hwlock_release(p->lock);
+    ply_fill(p);
+  }
+
+  res = f_close(&p->file);
+  if (p->res == FR_OK) p->res = res;
+  disk_chan_signal(c);    /* Tell ply_close() */
+
+  return p->res;
+}
+
+#endif /* _USE_PLAYER */
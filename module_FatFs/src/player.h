@@ -0,0 +1,54 @@
+/*-----------------------------------------------------------------------
+/  Playback pipeline on top of FatFs
+/-----------------------------------------------------------------------*/
+/* A reader core keeps the buffers of a pool filled ahead of a consumer
+/  core, which takes them in file order and hands them back without
+/  copying. The consumer never waits for the card or the FAT. */
+
+#ifndef _PLAYER
+
+#include "ff.h"
+#include <xccompat.h>
+
+#if _USE_PLAYER
+
+/* Statistics of a playback */
+typedef struct {
+        DWORD   released;               /* Buffers played and handed back by the consumer */
+        DWORD   underruns;              /* ply_get() calls that found no filled buffer */
+        DWORD   reads;                  /* f_read() calls of the reader */
+        DWORD   min_ready;              /* Fewest filled buffers found by ply_get() */
+} PLYSTAT;
+
+#ifndef __XC__
+/* Player object. The counters are guarded by the hardware lock. */
+typedef struct {
+        FIL     file;                   /* Played file */
+        BYTE*   pool;                   /* Buffer pool (nbuf * bsize bytes) */
+        UINT    bsize;                  /* Buffer size in bytes (multiple of 512) */
+        UINT    nbuf;                   /* Number of buffers */
+        DWORD   head;                   /* Buffers released by the consumer */
+        DWORD   tail;                   /* Buffers filled by the reader */
+        UINT    last;                   /* Bytes in the last buffer of the file */
+        FRESULT res;                    /* Result of the reads */
+        BYTE    eof;                    /* The reader has reached the end of the file */
+        BYTE    sleeping;               /* The reader waits for a doorbell */
+        BYTE    stop;                   /* The consumer has closed the playback */
+        unsigned lock;                  /* Hardware lock */
+        chanend c;                      /* Consumer end of the channel to the reader */
+        PLYSTAT stat;                   /* Statistics */
+} PLAYER;
+
+FRESULT ply_open (PLAYER*, const TCHAR*, BYTE*, UINT, UINT);    /* Open the file and set up the pool */
+void ply_attach (PLAYER*, chanend);     /* Register the consumer end of the channel */
+BYTE* ply_get (PLAYER*, UINT*);         /* Get the next filled buffer (non-blocking) */
+void ply_release (PLAYER*);             /* Hand the buffer got last back to the reader */
+int ply_eof (PLAYER*);                  /* The whole file has been got */
+FRESULT ply_close (PLAYER*);            /* Finish the playback and close the file */
+FRESULT ply_reader (PLAYER*, chanend);  /* Reader task */
+#endif
+
+#endif /* _USE_PLAYER */
+
+#define _PLAYER
+#endif
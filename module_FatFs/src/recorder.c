@@ -0,0 +1,274 @@
+/*-----------------------------------------------------------------------*/
+/* Recording pipeline on top of FatFs                                    */
+/*-----------------------------------------------------------------------*/
+/* The pool is a ring of nbuf buffers. The producer queues buffer        */
+/* tail % nbuf, the writer writes buffer head % nbuf to sector           */
+/* head * bsize / 512 of the file, which f_expand() made contiguous, so  */
+/* the writes need neither the FAT nor the directory. Runs of queued     */
+/* buffers that follow each other in the pool go in one multiple block   */
+/* write. The doorbell protocol is the one of the disk server.           */
+/*-----------------------------------------------------------------------*/
+
+#include <string.h>
+#include "recorder.h"
+#include "diskio.h"
+#include "hwlock.h"
+
+#if _USE_RECORDER
+
+#if !_USE_EXPAND || _FS_READONLY
+#error The recorder needs _USE_EXPAND on a writable file system.
+#endif
+
+#if _FS_REENTRANT  /* Disk access besides FatFs is done under the volume lock */
+#define LOCK_VOL(fs)    ff_req_grant((fs)->sobj)
+#define UNLOCK_VOL(fs)  ff_rel_grant((fs)->sobj)
+#else
+#define LOCK_VOL(fs)
+#define UNLOCK_VOL(fs)
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Create the file and set up the pool                                   */
+/*-----------------------------------------------------------------------*/
+
+FRESULT rec_open (
+  RECORDER *r,    /* Recorder object */
+  const TCHAR *path,  /* File to be recorded */
+  FSIZE_t size,    /* Largest size of the recording in bytes */
+  BYTE *pool,      /* Buffer pool of nbuf * bsize bytes, word aligned */
+  UINT nbuf,      /* Number of buffers (2..) */
+  UINT bsize      /* Buffer size in bytes (multiple of 512, up to 64KB) */
+)
+{
+  FRESULT res;
+  FATFS *fs;
+
+
+  if (nbuf < 2 || !bsize || bsize % 512 || bsize > 128 * 512 || !size)
+    return FR_INVALID_PARAMETER;
+
+  res = f_open(&r->file, path, FA_WRITE | FA_CREATE_ALWAYS);
+  if (res != FR_OK) return res;
+  size = (size + 511) / 512 * 512;
+  res = f_expand(&r->file, size, 1);  /* Preallocate a contiguous block */
+  if (res == FR_OK)
+    res = f_sync(&r->file);        /* The directory entry holds the block from now on */
+  if (res == FR_OK) {
+    r->lock = hwlock_alloc();
+    if (r->lock == HWLOCK_NONE) res = FR_NOT_ENOUGH_CORE;
+  }
+  if (res != FR_OK) {
+    f_close(&r->file);
+    return res;
+  }
+
+  fs = r->file.fs;
+  r->sect = fs->database + (r->file.sclust - 2) * fs->csize;
+  r->nsect = (DWORD)(size / 512);
+  r->pool = pool;
+  r->nbuf = nbuf;
+  r->bsize = bsize;
+  r->head = r->tail = 0;
+  r->bytes = 0;
+  r->res = FR_OK;
+  r->sleeping = 1;    /* The writer starts waiting for the first doorbell */
+  r->stop = 0;
+  memset(&r->stat, 0, sizeof r->stat);
+
+  return FR_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Register the producer end of the channel to the writer                */
+/*-----------------------------------------------------------------------*/
+
+void rec_attach (
+  RECORDER *r,    /* Recorder object */
+  chanend c    /* Producer end of the channel */
+)
+{
+  r->c = c;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the next free buffer                                              */
+/*-----------------------------------------------------------------------*/
+/* Returns 0 without waiting when all buffers are queued or the file is  */
+/* full (an overrun). The buffer is queued by rec_put().                 */
+
+BYTE* rec_get (
+  RECORDER *r    /* Recorder object */
+)
+{
+  DWORD used;
+
+
+  hwlock_acquire(r->lock);
+  used = r->tail - r->head;
+  hwlock_release(r->lock);
+  if (r->stop || used >= r->nbuf || (r->tail + 1) * (r->bsize / 512) > r->nsect) {
+    r->stat.overruns++;
+    return 0;
+  }
+  return r->pool + (r->tail % r->nbuf) * r->bsize;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Queue the buffer got last                                             */
+/*-----------------------------------------------------------------------*/
+/* Only the last buffer of a recording may hold less than bsize bytes.   */
+
+void rec_put (
+  RECORDER *r,    /* Recorder object */
+  UINT len      /* Number of data bytes in the buffer */
+)
+{
+  DWORD used;
+  BYTE s;
+
+
+  r->bytes += (len < r->bsize) ? len : r->bsize;
+  hwlock_acquire(r->lock);
+  r->tail++;
+  used = r->tail - r->head;
+  s = r->sleeping;
+  r->sleeping = 0;
+  hwlock_release(r->lock);
+  r->stat.queued++;
+  if (used > r->stat.max_used) r->stat.max_used = used;
+  if (s) disk_chan_signal(r->c);  /* Ring the doorbell */
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Number of free buffers                                                */
+/*-----------------------------------------------------------------------*/
+/* A producer that can lower its data rate uses it as back-pressure.     */
+
+UINT rec_free (
+  RECORDER *r    /* Recorder object */
+)
+{
+  DWORD used;
+
+
+  hwlock_acquire(r->lock);
+  used = r->tail - r->head;
+  hwlock_release(r->lock);
+  return r->nbuf - used;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Finish the recording                                                  */
+/*-----------------------------------------------------------------------*/
+/* Waits until the writer has written the queued buffers and closed the  */
+/* file at the recorded size.                                            */
+
+FRESULT rec_close (
+  RECORDER *r    /* Recorder object */
+)
+{
+  BYTE s;
+
+
+  hwlock_acquire(r->lock);
+  r->stop = 1;
+  s = r->sleeping;
+  r->sleeping = 0;
+  hwlock_release(r->lock);
+  if (s) disk_chan_signal(r->c);  /* Wake up the writer */
+  disk_chan_wait(r->c);      /* Wait for the file to be closed */
+  hwlock_free(r->lock);
+
+  return r->res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write the queued buffers                                              */
+/*-----------------------------------------------------------------------*/
+
+static
+int rec_drain (    /* 1:Recording closed, 0:Queue empty */
+  RECORDER *r    /* Recorder object */
+)
+{
+  FATFS *fs = r->file.fs;
+  DWORD i, n, spb = r->bsize / 512;
+
+
+  for (;;) {
+    hwlock_acquire(r->lock);
+    n = r->tail - r->head;
+    if (!n) {
+      if (r->stop) {
+        hwlock_release(r->lock);
+        return 1;
+      }
+      r->sleeping = 1;
+      hwlock_release(r->lock);
+      return 0;
+    }
+    hwlock_release(r->lock);
+
+    i = r->head % r->nbuf;
+    if (n > r->nbuf - i) n = r->nbuf - i;  /* Buffers following each other in the pool */
+    if (n > 255 / spb) n = 255 / spb;    /* Sector count of a disk_write() */
+    if (r->res == FR_OK) {        /* After an error the buffers are dropped */
+      LOCK_VOL(fs);
+      if (disk_write(fs->drv, r->pool + i * r->bsize, r->sect + r->head * spb, (BYTE)(n * spb)) != RES_OK)
+        r->res = FR_DISK_ERR;
+      UNLOCK_VOL(fs);
+      r->stat.writes++;
+    }
+
+    hwlock_acquire(r->lock);
+    r->head += n;
+    hwlock_release(r->lock);
+  }
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Writer task                                                           */
+/*-----------------------------------------------------------------------*/
+/* Runs on its own core until rec_close(), then cuts the file at the     */
+/* recorded size and closes it.                                          */
+
+FRESULT rec_writer (
+  RECORDER *r,    /* Recorder object */
+  chanend c    /* Writer end of the channel to the producer */
+)
+{
+  FRESULT res;
+
+
+  do
+    disk_chan_wait(c);    /* Sleep until the producer rings the doorbell */
+  while (!rec_drain(r));
+
+  res = f_lseek(&r->file, r->bytes);
+  if (res == FR_OK) res = f_truncate(&r->file);
+  if (r->res == FR_OK) r->res = res;
+  res = f_close(&r->file);
+  if (r->res == FR_OK) r->res = res;
+  disk_chan_signal(c);    /* Tell rec_close() */
+
+  return r->res;
+}
+
+#endif /* _USE_RECORDER */
@@ -0,0 +1,56 @@
+/*-----------------------------------------------------------------------
+/  Recording pipeline on top of FatFs
+/-----------------------------------------------------------------------*/
+/* A producer core fills the buffers of a pool and queues them without
+/  blocking, a writer core writes them to a preallocated contiguous file
+/  with multiple block writes. The depth of the pool absorbs the busy time
+/  of the card, the producer never waits for it. */
+
+#ifndef _RECORDER
+
+#include "ff.h"
+#include <xccompat.h>
+
+#if _USE_RECORDER
+
+/* Statistics of a recording */
+typedef struct {
+        DWORD   queued;                 /* Buffers queued by the producer */
+        DWORD   overruns;               /* rec_get() calls that found no free buffer */
+        DWORD   writes;                 /* Multiple block writes issued */
+        DWORD   max_used;               /* Largest number of buffers in the queue */
+} RECSTAT;
+
+#ifndef __XC__
+/* Recorder object. The counters are guarded by the hardware lock. */
+typedef struct {
+        FIL     file;                   /* Recorded file */
+        BYTE*   pool;                   /* Buffer pool (nbuf * bsize bytes) */
+        UINT    bsize;                  /* Buffer size in bytes (multiple of 512) */
+        UINT    nbuf;                   /* Number of buffers */
+        DWORD   head;                   /* Buffers written by the writer */
+        DWORD   tail;                   /* Buffers queued by the producer */
+        DWORD   sect;                   /* First sector of the file */
+        DWORD   nsect;                  /* Size of the file in sectors */
+        FSIZE_t bytes;                  /* Bytes queued */
+        FRESULT res;                    /* Result of the writes */
+        BYTE    sleeping;               /* The writer waits for a doorbell */
+        BYTE    stop;                   /* The producer has closed the recording */
+        unsigned lock;                  /* Hardware lock */
+        chanend c;                      /* Producer end of the channel to the writer */
+        RECSTAT stat;                   /* Statistics */
+} RECORDER;
+
+FRESULT rec_open (RECORDER*, const TCHAR*, FSIZE_t, BYTE*, UINT, UINT); /* Create the file and set up the pool */
+void rec_attach (RECORDER*, chanend);   /* Register the producer end of the channel */
+BYTE* rec_get (RECORDER*);              /* Get the next free buffer (non-blocking) */
+void rec_put (RECORDER*, UINT);         /* Queue the buffer got last */
+UINT rec_free (RECORDER*);              /* Number of free buffers */
+FRESULT rec_close (RECORDER*);          /* Finish the recording and close the file */
+FRESULT rec_writer (RECORDER*, chanend);        /* Writer task */
+#endif
+
+#endif /* _USE_RECORDER */
+
+#define _RECORDER
+#endif
@@ -0,0 +1,345 @@
+/*-----------------------------------------------------------------------*/
+/* Ring log file on top of FatFs                                         */
+/*-----------------------------------------------------------------------*/
+/* Sector 0 of the file is the header, the nsect sectors behind it are   */
+/* the ring. The sector with sequence number seq is stored in ring       */
+/* sector seq % nsect, so an append is one single block write in place.  */
+/* The header records head and tail only when the log is synced. After a */
+/* power loss the head is found by scanning forward from the recorded    */
+/* one while the sectors carry the expected sequence numbers.            */
+/*-----------------------------------------------------------------------*/
+
+#include <string.h>
+#include "ringlog.h"
+#include "diskio.h"
+
+#if _USE_RINGLOG
+
+#if !_USE_EXPAND || _FS_READONLY
+#error The ring log needs _USE_EXPAND on a writable file system.
+#endif
+
+#if _FS_REENTRANT  /* Disk access besides FatFs is done under the volume lock */
+#define LOCK_VOL(fs)    ff_req_grant((fs)->sobj)
+#define UNLOCK_VOL(fs)  ff_rel_grant((fs)->sobj)
+#else
+#define LOCK_VOL(fs)
+#define UNLOCK_VOL(fs)
+#endif
+
+/* Layout of the header sector */
+#define RH_MAGIC    0    /* "RLOG" (DWORD) */
+#define RH_NSECT    4    /* Number of ring sectors (DWORD) */
+#define RH_STAMP    8    /* Stamp of the log (DWORD) */
+#define RH_HEAD     12   /* Head at the last sync (DWORD) */
+#define RH_TAIL     16   /* Tail at the last sync (DWORD) */
+#define RH_SECT     20   /* First sector of the file (DWORD) */
+
+#define RLOG_MAGIC  0x474F4C52
+
+#define RL_ZVEC     16   /* Sectors per write when the ring of a new log is cleared */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Transfer a sector of the file                                         */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT rlog_disk (
+  RINGLOG *r,    /* Ring log object */
+  BYTE *buff,    /* Sector data */
+  DWORD sect,    /* Sector number in the file */
+  BYTE wr      /* 0:Read, 1:Write */
+)
+{
+  FATFS *fs = r->file.fs;
+  DRESULT dr;
+
+
+  LOCK_VOL(fs);
+  sect += r->sect - 1;
+  dr = wr ? disk_write(fs->drv, buff, sect, 1) : disk_read(fs->drv, buff, sect, 1);
+  UNLOCK_VOL(fs);
+
+  return dr == RES_OK ? FR_OK : FR_DISK_ERR;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Clear the ring                                                        */
+/*-----------------------------------------------------------------------*/
+/* All segments of the list point to the same zeroed sector, so the ring */
+/* is written with multiple block writes of RL_ZVEC sectors from r->buf. */
+
+static
+FRESULT rlog_clear (
+  RINGLOG *r    /* Ring log object */
+)
+{
+  FATFS *fs = r->file.fs;
+  DISKVEC vec[RL_ZVEC];
+  DRESULT dr = RES_OK;
+  DWORD i;
+  UINT n;
+
+
+  memset(r->buf, 0, 512);
+  for (n = 0; n < RL_ZVEC; n++) {
+    vec[n].buff = r->buf;
+    vec[n].count = 1;
+  }
+  for (i = 0; i < r->nsect && dr == RES_OK; i += n) {
+    n = (r->nsect - i < RL_ZVEC) ? (UINT)(r->nsect - i) : RL_ZVEC;
+    LOCK_VOL(fs);
+    dr = disk_writev(fs->drv, vec, n, r->sect + i);
+    UNLOCK_VOL(fs);
+  }
+
+  return dr == RES_OK ? FR_OK : FR_DISK_ERR;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write the sector being filled to its place in the ring                */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT rlog_put (
+  RINGLOG *r    /* Ring log object */
+)
+{
+  ST_DWORD(r->buf+RL_SEQ, r->head);
+  ST_DWORD(r->buf+RL_CHK, r->head ^ r->stamp);
+  ST_WORD(r->buf+RL_LEN, r->len);
+  memset(r->buf + RL_DATA + r->len, 0, RL_PAYLOAD - r->len);
+
+  return rlog_disk(r, r->buf, 1 + r->head % r->nsect, 1);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write the header                                                      */
+/*-----------------------------------------------------------------------*/
+/* Uses the caller's sector buffer, the sector being filled stays in     */
+/* r->buf.                                                               */
+
+static
+FRESULT rlog_put_header (
+  RINGLOG *r,    /* Ring log object */
+  BYTE *buff    /* 512 byte work buffer */
+)
+{
+  memset(buff, 0, 512);
+  ST_DWORD(buff+RH_MAGIC, RLOG_MAGIC);
+  ST_DWORD(buff+RH_NSECT, r->nsect);
+  ST_DWORD(buff+RH_STAMP, r->stamp);
+  ST_DWORD(buff+RH_HEAD, r->head);
+  ST_DWORD(buff+RH_TAIL, r->tail);
+  ST_DWORD(buff+RH_SECT, r->sect - 1);
+
+  return rlog_disk(r, buff, 0, 1);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Open or create a ring log                                             */
+/*-----------------------------------------------------------------------*/
+/* An existing ring log keeps its size and its data, a new one gets      */
+/* nsect ring sectors. Any other existing file is rejected with          */
+/* FR_INVALID_OBJECT. The ring of a new log is cleared before the header */
+/* is written, as the stamp depends on get_fattime() and the location    */
+/* only and need not differ from the one of a deleted log.               */
+
+FRESULT rlog_open (
+  RINGLOG *r,      /* Ring log object */
+  const TCHAR *path,  /* File name */
+  DWORD nsect      /* Number of ring sectors of a new log (2..) */
+)
+{
+  FRESULT res;
+  FATFS *fs;
+  DWORD i, seq;
+  UINT len;
+
+
+  res = f_open(&r->file, path, FA_READ | FA_WRITE | FA_OPEN_EXISTING);
+  if (res == FR_NO_FILE) {          /* Create a new log */
+    if (nsect < 2) return FR_INVALID_PARAMETER;
+    res = f_open(&r->file, path, FA_READ | FA_WRITE | FA_CREATE_NEW);
+    if (res != FR_OK) return res;
+    res = f_expand(&r->file, (FSIZE_t)(nsect + 1) * 512, 1);
+    if (res == FR_OK)
+      res = f_sync(&r->file);      /* The directory entry holds the block from now on */
+    if (res == FR_OK) {
+      fs = r->file.fs;
+      r->sect = fs->database + (r->file.sclust - 2) * fs->csize + 1;
+      r->nsect = nsect;
+      r->stamp = get_fattime() ^ r->sect;
+      r->head = r->tail = 0;
+      r->len = 0;
+      res = rlog_clear(r);        /* Stale sectors must not pass for data */
+    }
+    if (res == FR_OK) res = rlog_put_header(r, r->buf);
+    if (res != FR_OK) f_close(&r->file);
+    return res;
+  }
+  if (res != FR_OK) return res;
+
+  fs = r->file.fs;                /* Check the header of an existing log */
+  r->sect = r->file.sclust ? fs->database + (r->file.sclust - 2) * fs->csize + 1 : 0;
+  res = FR_INVALID_OBJECT;
+  if (r->sect && r->file.fsize >= 3 * 512 && rlog_disk(r, r->buf, 0, 0) == FR_OK) {
+    r->nsect = LD_DWORD(r->buf+RH_NSECT);
+    if (LD_DWORD(r->buf+RH_MAGIC) == RLOG_MAGIC
+      && LD_DWORD(r->buf+RH_SECT) == r->sect - 1
+      && r->file.fsize == (FSIZE_t)(r->nsect + 1) * 512)
+      res = FR_OK;
+  }
+  if (res != FR_OK) {
+    f_close(&r->file);
+    return res;
+  }
+  r->stamp = LD_DWORD(r->buf+RH_STAMP);
+  r->head = LD_DWORD(r->buf+RH_HEAD);
+  r->len = 0;
+
+  for (i = 0; i < r->nsect; i++) {      /* Find the head written after the last sync */
+    res = rlog_disk(r, r->buf, 1 + r->head % r->nsect, 0);
+    if (res != FR_OK) break;
+    seq = LD_DWORD(r->buf+RL_SEQ);
+    len = LD_WORD(r->buf+RL_LEN);
+    if (seq != r->head || LD_DWORD(r->buf+RL_CHK) != (seq ^ r->stamp) || len > RL_PAYLOAD) break;
+    if (len < RL_PAYLOAD) {          /* A partial sector is the head, go on filling it */
+      r->len = len;
+      break;
+    }
+    r->head++;
+  }
+  r->tail = (r->head >= r->nsect) ? r->head - r->nsect + 1 : 0;
+  if (res != FR_OK) f_close(&r->file);
+
+  return res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Append data                                                           */
+/*-----------------------------------------------------------------------*/
+/* Each sector filled is written in place. When the ring is full the     */
+/* oldest sector is overwritten.                                         */
+
+FRESULT rlog_append (
+  RINGLOG *r,      /* Ring log object */
+  const void *buff,  /* Data to be appended */
+  UINT btw      /* Number of bytes */
+)
+{
+  const BYTE *p = buff;
+  UINT n;
+  FRESULT res;
+
+
+  while (btw) {
+    n = RL_PAYLOAD - r->len;
+    if (n > btw) n = btw;
+    memcpy(r->buf + RL_DATA + r->len, p, n);
+    r->len += n; p += n; btw -= n;
+    if (r->len == RL_PAYLOAD) {      /* Sector filled */
+      res = rlog_put(r);
+      if (res != FR_OK) return res;
+      r->head++;
+      r->len = 0;
+      if (r->head >= r->nsect) r->tail = r->head - r->nsect + 1;
+    }
+  }
+
+  return FR_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write the partial sector and the header                               */
+/*-----------------------------------------------------------------------*/
+/* The partial sector is written again when it has been filled.          */
+
+FRESULT rlog_sync (
+  RINGLOG *r    /* Ring log object */
+)
+{
+  FRESULT res = FR_OK;
+  BYTE hdr[512];
+
+
+  if (r->len) res = rlog_put(r);
+  if (res == FR_OK) res = rlog_put_header(r, hdr);
+  if (res == FR_OK && disk_ioctl(r->file.fs->drv, CTRL_SYNC, 0) != RES_OK)
+    res = FR_DISK_ERR;
+
+  return res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read the data of a sector                                             */
+/*-----------------------------------------------------------------------*/
+/* Sequence numbers from tail up to head are in the log, the data of     */
+/* head are the bytes appended to it so far. FR_NO_FILE is returned for  */
+/* a sequence number that is not in the log.                             */
+
+FRESULT rlog_read (
+  RINGLOG *r,    /* Ring log object */
+  DWORD seq,    /* Sequence number */
+  void *buff,    /* 512 byte buffer to return the data at its top */
+  UINT *br    /* Pointer to return the number of data bytes */
+)
+{
+  BYTE *p = buff;
+  FRESULT res;
+
+
+  *br = 0;
+  if (seq - r->tail > r->head - r->tail) return FR_NO_FILE;
+  if (seq == r->head) {            /* Not written yet */
+    memcpy(p, r->buf + RL_DATA, r->len);
+    *br = r->len;
+    return FR_OK;
+  }
+
+  res = rlog_disk(r, p, 1 + seq % r->nsect, 0);
+  if (res != FR_OK) return res;
+  if (LD_DWORD(p+RL_SEQ) != seq || LD_DWORD(p+RL_CHK) != (seq ^ r->stamp) || LD_WORD(p+RL_LEN) > RL_PAYLOAD)
+    return FR_NO_FILE;            /* Lost in a power failure */
+  *br = LD_WORD(p+RL_LEN);
+  memmove(p, p + RL_DATA, *br);
+
+  return FR_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Close the ring log                                                    */
+/*-----------------------------------------------------------------------*/
+
+FRESULT rlog_close (
+  RINGLOG *r    /* Ring log object */
+)
+{
+  FRESULT res, res2;
+
+
+  res = rlog_sync(r);
+  res2 = f_close(&r->file);
+
+  return res != FR_OK ? res : res2;
+}
+
+#endif /* _USE_RINGLOG */
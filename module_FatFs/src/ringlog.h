@@ -0,0 +1,42 @@
+/*-----------------------------------------------------------------------
+/  Ring log file on top of FatFs
+/-----------------------------------------------------------------------*/
+/* A ring log is a preallocated contiguous file used as a circular buffer
+/  of sectors. Appending writes sectors in place, the FAT and the directory
+/  are never touched after the file has been created. */
+
+#ifndef _RINGLOG
+
+#include "ff.h"
+
+#if _USE_RINGLOG
+
+/* Layout of a ring log sector */
+#define RL_SEQ          0               /* Sequence number of the sector (DWORD) */
+#define RL_CHK          4               /* Sequence number xor stamp of the log (DWORD) */
+#define RL_LEN          8               /* Number of data bytes (WORD) */
+#define RL_DATA         12              /* Data */
+#define RL_PAYLOAD      (512 - RL_DATA) /* Data bytes in a full sector */
+
+/* Ring log object */
+typedef struct {
+        FIL     file;                   /* Log file */
+        DWORD   sect;                   /* First ring sector (behind the header sector) */
+        DWORD   nsect;                  /* Number of ring sectors */
+        DWORD   stamp;                  /* Stamp of the log, tells its sectors from stale data */
+        DWORD   head;                   /* Sequence number of the sector being filled */
+        DWORD   tail;                   /* Oldest sequence number in the ring */
+        UINT    len;                    /* Data bytes in buf */
+        BYTE    buf[512];               /* Sector being filled */
+} RINGLOG;
+
+FRESULT rlog_open (RINGLOG*, const TCHAR*, DWORD);      /* Open or create a ring log and find its head */
+FRESULT rlog_append (RINGLOG*, const void*, UINT);      /* Append data */
+FRESULT rlog_sync (RINGLOG*);                           /* Write the partial sector and the header */
+FRESULT rlog_read (RINGLOG*, DWORD, void*, UINT*);      /* Read the data of a sector by sequence number */
+FRESULT rlog_close (RINGLOG*);                          /* Sync and close the ring log */
+
+#endif /* _USE_RINGLOG */
+
+#define _RINGLOG
+#endif
@@ -0,0 +1,87 @@
+/*------------------------------------------------------------------------*/
+/* Sync functions for FatFs on the xCORE                                  */
+/*------------------------------------------------------------------------*/
+/* Each volume is guarded by a hardware lock of its own, so cores working
+/  on different volumes never wait for each other. A hardware lock has no
+/  timeout: ff_req_grant() waits until the lock is free and _FS_TIMEOUT
+/  has no effect. All cores using the file system must be on one tile. */
+
+#include "ff.h"
+#include "hwlock.h"
+
+#if _FS_REENTRANT
+
+/*------------------------------------------------------------------------*/
+/* Create a Synchronization Object                                        */
+/*------------------------------------------------------------------------*/
+/* This function is called by f_mount() to create a new synchronization
+/  object for the volume. When a zero is returned, the f_mount() function
+/  fails with FR_INT_ERR.
+*/
+
+int ff_cre_syncobj (  /* 1:Function succeeded, 0:Could not create due to any error */
+  BYTE vol,      /* Corresponding logical drive being processed */
+  _SYNC_t *sobj    /* Pointer to return the created sync object */
+)
+{
+  (void)vol;
+  *sobj = hwlock_alloc();    /* Allocate a hardware lock */
+
+  return (*sobj != HWLOCK_NONE);
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Delete a Synchronization Object                                        */
+/*------------------------------------------------------------------------*/
+/* This function is called in f_mount() to delete a synchronization
+/  object that created with ff_cre_syncobj() function. When a zero is
+/  returned, the f_mount() function fails with FR_INT_ERR.
+*/
+
+int ff_del_syncobj (  /* 1:Function succeeded, 0:Could not delete due to any error */
+  _SYNC_t sobj    /* Sync object tied to the logical drive to be deleted */
+)
+{
+  if (sobj == HWLOCK_NONE) return 0;
+  hwlock_free(sobj);
+
+  return 1;
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Request Grant to Access the Volume                                     */
+/*------------------------------------------------------------------------*/
+/* This function is called on entering file functions to lock the volume.
+/  The hardware lock pauses the core until the lock is released, so the
+/  grant never fails.
+*/
+
+int ff_req_grant (  /* TRUE:Got a grant to access the volume, FALSE:Could not get a grant */
+  _SYNC_t sobj  /* Sync object to wait */
+)
+{
+  hwlock_acquire(sobj);
+
+  return 1;
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Release Grant to Access the Volume                                     */
+/*------------------------------------------------------------------------*/
+/* This function is called on leaving file functions to unlock the volume.
+*/
+
+void ff_rel_grant (
+  _SYNC_t sobj  /* Sync object to be signaled */
+)
+{
+  hwlock_release(sobj);
+}
+
+#endif